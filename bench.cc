@@ -0,0 +1,439 @@
+/*------------------------------------------------------------------------------
+ * Rapic Protocol Support Library
+ *
+ * Copyright 2016 Commonwealth of Australia, Bureau of Meteorology
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *----------------------------------------------------------------------------*/
+#include "rapic.h"
+
+#include <arpa/inet.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <system_error>
+#include <thread>
+
+static const char* try_again = "try --help for usage instructions\n";
+static const char* usage_string =
+R"(Rapic library benchmark
+
+usage:
+  rapic_bench [options] [recorded.rapic ...]
+
+note:
+  Synthetic scans are generated deterministically so that results are comparable between builds.  Any rapic
+  files supplied on the command line are also decoded and reported individually.
+
+available options:
+  -h, --help
+      Show this message and exit
+
+  -n, --scans N
+      Number of scans to process in each benchmark (default 1000)
+
+  -b, --bins N
+      Number of range bins in each synthetic scan (default 1000)
+
+  -o, --odim PATH
+      Path of the temporary file used by the ODIM benchmark (default rapic_bench.h5)
+)";
+
+static const char* short_options = "hn:b:o:";
+static struct option long_options[] =
+{
+    { "help",  no_argument,       0, 'h' }
+  , { "scans", required_argument, 0, 'n' }
+  , { "bins",  required_argument, 0, 'b' }
+  , { "odim",  required_argument, 0, 'o' }
+  , { 0, 0, 0, 0 }
+};
+
+using bench_clock = std::chrono::steady_clock;
+
+// simple deterministic random number generator so that inputs are identical on every platform
+struct lcg
+{
+  uint32_t state;
+  auto operator()(uint32_t limit) -> uint32_t
+  {
+    state = state * 1664525u + 1013904223u;
+    return (state >> 8) % limit;
+  }
+};
+
+auto report(char const* name, size_t bytes, size_t scans, bench_clock::duration elapsed) -> void
+{
+  auto secs = std::chrono::duration<double>(elapsed).count();
+  printf("%-32s %10.1f MB/s %10.1f scans/s\n", name, bytes / secs / (1024.0 * 1024.0), scans / secs);
+}
+
+// generate a field of levels with a weather like structure of echo cells over a clear background
+auto make_field(int rays, int bins, bool vel, int levels, uint32_t seed) -> std::vector<uint8_t>
+{
+  lcg rng{seed};
+  std::vector<uint8_t> field(rays * bins, 0);
+
+  for (int cell = 0; cell < 12; ++cell)
+  {
+    int cr = rng(rays), cb = rng(bins), size = 5 + rng(bins / 8), peak = levels / 2 + rng(levels / 2);
+    for (int r = cr - size; r <= cr + size; ++r)
+    {
+      auto row = &field[((r + rays) % rays) * bins];
+      for (int b = std::max(0, cb - size); b < std::min(bins, cb + size); ++b)
+      {
+        int dist = std::abs(r - cr) + std::abs(b - cb);
+        if (dist >= size)
+          continue;
+        int lvl;
+        if (vel)
+          lvl = 1 + (levels - 2) * (r + rays) / (2 * rays) % (levels - 1) + rng(3) - 1;
+        else
+          lvl = peak * (size - dist) / size + rng(3) - 1;
+        lvl = std::max(vel ? 1 : 0, std::min(levels - 1, lvl));
+        row[b] = std::max<int>(row[b], lvl);
+      }
+    }
+  }
+  return field;
+}
+
+// standard scan headers
+auto make_headers(int pass, int passes, int rays, int bins, bool vel, bool binary) -> std::string
+{
+  char buf[512];
+  snprintf(
+        buf
+      , sizeof(buf)
+      , "/IMAGE: 0502 1612160000\n"
+        "COUNTRY: 036\nNAME: Bench\nSTNID: 2\nLATITUDE: -37.852\nLONGITUDE: 144.752\nHEIGHT: 44\n"
+        "DATE: 12316\nTIME: 00.00\nTIMESTAMP: 20161116000012\nVERS: 10.01\nFREQUENCY: 2800\n"
+        "PRODUCT: VOLUMETRIC [0000316016]\nPASS: %02d of %02d\nIMGFMT: PPI\nELEV: %05.1f\nTILT: %02d of %02d\n"
+        "VIDEO: %s\nVIDRES: %d\n%s"
+        "ANGRES: %.1f\nSTARTRNG: 0\nENDRNG: %d\nRNGRES: 250\n"
+      , pass, passes, 0.5 * ((pass + 1) / 2), (pass + 1) / 2, (passes + 1) / 2
+      , vel ? "Vel" : "Refl"
+      , vel ? (binary ? 256 : 160) : 160
+      , vel ? "NYQUIST: 13.3\n" : "VIDEOGAIN: 0.5\nVIDEOOFFSET: -32.0\n"
+      , 360.0 / rays, bins * 250);
+  return buf;
+}
+
+// encode a field using the ASCII absolute and run length encodings
+auto encode_ascii(int rays, int bins, std::vector<uint8_t> const& field) -> std::string
+{
+  static char const low[] = "ABCDEFGHIJKLMNOP\"'*,:;=?QRZ^_z|~";
+
+  std::string out;
+  char buf[16];
+  for (int r = 0; r < rays; ++r)
+  {
+    snprintf(buf, sizeof(buf), "%%%03d", r);
+    out += buf;
+
+    auto row = &field[r * bins];
+    for (int b = 0; b < bins; )
+    {
+      int lvl = row[b], run = 1;
+      while (b + run < bins && row[b + run] == lvl)
+        ++run;
+      out += lvl < 32 ? low[lvl] : static_cast<char>(0x80 + lvl - 32);
+      if (run > 2)
+        out += std::to_string(run - 1);
+      else if (run == 2)
+        out += out.back();
+      b += run;
+    }
+    out += '\n';
+  }
+  return out;
+}
+
+// encode a field using the binary encoding
+auto encode_binary(int rays, int bins, std::vector<uint8_t> const& field, float elev) -> std::string
+{
+  std::string out;
+  std::string data;
+  char buf[32];
+  for (int r = 0; r < rays; ++r)
+  {
+    snprintf(buf, sizeof(buf), "@%05.1f,%05.1f,%03d=", r * 360.0 / rays, elev, r % 1000);
+    out += buf;
+
+    auto row = &field[r * bins];
+    data.clear();
+    for (int b = 0; b < bins; )
+    {
+      int lvl = row[b], run = 1;
+      if (lvl > 1)
+      {
+        data += static_cast<char>(lvl);
+        ++b;
+        continue;
+      }
+      while (b + run < bins && run < 255 && row[b + run] == lvl)
+        ++run;
+      data += static_cast<char>(lvl);
+      data += static_cast<char>(run);
+      b += run;
+    }
+    data += '\0';
+    data += '\0';
+
+    auto len = data.size() + 18;
+    out += static_cast<char>(len >> 8);
+    out += static_cast<char>(len & 0xff);
+    out += data;
+  }
+  return out;
+}
+
+auto make_scan(int pass, int passes, int bins, bool vel, bool binary, uint32_t seed) -> std::string
+{
+  int const rays = 360;
+  auto field = make_field(rays, bins, vel, vel && binary ? 256 : 160, seed);
+  auto msg = make_headers(pass, passes, rays, bins, vel, binary);
+  msg += binary ? encode_binary(rays, bins, field, 0.5 * ((pass + 1) / 2)) : encode_ascii(rays, bins, field);
+  msg += "END RADAR IMAGE\n";
+  return msg;
+}
+
+auto bench_decode(char const* name, std::vector<std::string> const& msgs, size_t count, rapic::decode_mode mode) -> void
+{
+  rapic::scan scan;
+  size_t bytes = 0;
+  auto start = bench_clock::now();
+  for (size_t i = 0; i < count; ++i)
+  {
+    auto& msg = msgs[i % msgs.size()];
+    scan.decode(reinterpret_cast<uint8_t const*>(msg.data()), msg.size(), mode);
+    bytes += msg.size();
+  }
+  report(name, bytes, count, bench_clock::now() - start);
+}
+
+auto bench_decode_file(char const* path) -> void
+{
+  // locate the scans first so that only decoding is measured
+  rapic::file_reader in{path};
+  std::vector<std::pair<uint8_t const*, size_t>> msgs;
+  uint8_t const* data;
+  size_t size, bytes = 0;
+  while (in.next(data, size))
+  {
+    msgs.emplace_back(data, size);
+    bytes += size;
+  }
+
+  rapic::scan scan;
+  auto start = bench_clock::now();
+  for (auto& msg : msgs)
+    scan.decode(msg.first, msg.second);
+  report(("decode " + std::string(path)).c_str(), bytes, msgs.size(), bench_clock::now() - start);
+}
+
+auto bench_dequeue(std::vector<std::string> const& msgs, size_t count) -> void
+{
+  // build the stream
+  std::string stream;
+  for (size_t i = 0; i < count; ++i)
+  {
+    if (i % 10 == 0)
+      stream += "MSSG: 10 Radar status nominal\n";
+    stream += msgs[i % msgs.size()];
+  }
+
+  // listen on an ephemeral loopback port
+  auto listener = socket(AF_INET, SOCK_STREAM, 0);
+  if (listener == -1)
+    throw std::system_error{errno, std::system_category(), "failed to create listen socket"};
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t addr_len = sizeof(addr);
+  if (   bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == -1
+      || listen(listener, 1) == -1
+      || getsockname(listener, reinterpret_cast<sockaddr*>(&addr), &addr_len) == -1)
+  {
+    auto err = errno;
+    close(listener);
+    throw std::system_error{err, std::system_category(), "failed to listen on loopback"};
+  }
+
+  // serve the stream in fragments of varying size to exercise message reassembly
+  std::thread server{[&]
+  {
+    auto fd = accept(listener, nullptr, nullptr);
+    if (fd == -1)
+      return;
+    lcg rng{1};
+    size_t pos = 0;
+    while (pos < stream.size())
+    {
+      auto len = std::min<size_t>(1 + rng(2920), stream.size() - pos);
+      auto ret = write(fd, &stream[pos], len);
+      if (ret <= 0)
+        break;
+      pos += ret;
+    }
+    shutdown(fd, SHUT_WR);
+    char buf[256];
+    while (read(fd, buf, sizeof(buf)) > 0)
+      ;
+    close(fd);
+  }};
+
+  size_t scans = 0;
+  auto start = bench_clock::now();
+  try
+  {
+    rapic::client con;
+    con.connect("127.0.0.1", std::to_string(ntohs(addr.sin_port)));
+    while (con.connection_state() != rapic::connection_state::disconnected)
+    {
+      con.poll(1000);
+      bool again = true;
+      while (again)
+      {
+        again = con.process_traffic();
+        rapic::message_type type;
+        while (con.dequeue(type))
+          if (type == rapic::message_type::scan)
+            ++scans;
+      }
+    }
+  }
+  catch (...)
+  {
+    server.join();
+    close(listener);
+    throw;
+  }
+  auto elapsed = bench_clock::now() - start;
+  server.join();
+  close(listener);
+
+  if (scans != count)
+    throw std::runtime_error{"dequeue benchmark received " + std::to_string(scans) + " of " + std::to_string(count) + " scans"};
+  report("dequeue fragmented stream", stream.size(), scans, elapsed);
+}
+
+#ifdef RAPIC_WITH_ODIM
+auto bench_odim(char const* path, int bins, size_t count) -> void
+{
+  // a volume of 14 tilts each containing a reflectivity and velocity pass
+  int const passes = 28;
+  std::list<rapic::scan> volume;
+  size_t bytes = 0;
+  for (int pass = 1; pass <= passes; ++pass)
+  {
+    auto msg = make_scan(pass, passes, bins, pass % 2 == 0, true, pass);
+    volume.emplace_back();
+    volume.back().decode(reinterpret_cast<uint8_t const*>(msg.data()), msg.size());
+    bytes += volume.back().rays() * volume.back().bins();
+  }
+
+  auto volumes = std::max<size_t>(1, count / passes);
+  auto start = bench_clock::now();
+  for (size_t i = 0; i < volumes; ++i)
+    rapic::write_odim_h5_volume(path, volume);
+  report("write_odim_h5_volume (levels)", bytes * volumes, passes * volumes, bench_clock::now() - start);
+  unlink(path);
+}
+#endif
+
+int main(int argc, char* argv[])
+{
+  size_t count = 1000;
+  int bins = 1000;
+  char const* odim_path = "rapic_bench.h5";
+
+  // process options
+  while (true)
+  {
+    int option_index = 0;
+    int c = getopt_long(argc, argv, short_options, long_options, &option_index);
+    if (c == -1)
+      break;
+    switch (c)
+    {
+    case 'h':
+      std::cout << usage_string;
+      return EXIT_SUCCESS;
+    case 'n':
+      count = std::max(1l, atol(optarg));
+      break;
+    case 'b':
+      bins = std::max(1, atoi(optarg));
+      break;
+    case 'o':
+      odim_path = optarg;
+      break;
+    case '?':
+      std::cerr << try_again;
+      return EXIT_FAILURE;
+    }
+  }
+
+  try
+  {
+    std::cout << "Rapic library benchmark\nVersion: " << rapic::release_tag() << std::endl;
+
+    // generate a small set of distinct scans for each encoding and moment type
+    std::vector<std::string> ascii_refl, ascii_vel, binary_refl, binary_vel, mixed;
+    for (uint32_t i = 0; i < 4; ++i)
+    {
+      ascii_refl.push_back(make_scan(1, 2, bins, false, false, i));
+      ascii_vel.push_back(make_scan(2, 2, bins, true, false, i));
+      binary_refl.push_back(make_scan(1, 2, bins, false, true, i));
+      binary_vel.push_back(make_scan(2, 2, bins, true, true, i));
+      mixed.insert(mixed.end(), { ascii_refl.back(), ascii_vel.back(), binary_refl.back(), binary_vel.back() });
+    }
+
+    bench_decode("decode ascii refl", ascii_refl, count, rapic::decode_mode::full);
+    bench_decode("decode ascii vel", ascii_vel, count, rapic::decode_mode::full);
+    bench_decode("decode binary refl", binary_refl, count, rapic::decode_mode::full);
+    bench_decode("decode binary vel", binary_vel, count, rapic::decode_mode::full);
+    bench_decode("decode headers only", mixed, count, rapic::decode_mode::headers_only);
+
+    for (int i = optind; i < argc; ++i)
+      bench_decode_file(argv[i]);
+
+    bench_dequeue(mixed, count);
+
+#ifdef RAPIC_WITH_ODIM
+    bench_odim(odim_path, bins, count);
+#else
+    (void) odim_path;
+#endif
+  }
+  catch (std::exception& err)
+  {
+    std::cout << "fatal error: " << err.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+  catch (...)
+  {
+    std::cout << "fatal error: unknown" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
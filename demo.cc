@@ -25,7 +25,7 @@
 
 #include <fstream>
 
-auto handle_rapic_messages(rapic::client& con) -> void
+auto handle_rapic_messages(rapic::client& con, rapic::scan& msg) -> void
 {
   rapic::message_type type;
   while (con.dequeue(type))
@@ -42,7 +42,6 @@ auto handle_rapic_messages(rapic::client& con) -> void
     case rapic::message_type::scan:
       try
       {
-        rapic::scan msg;
         con.decode(msg);
         std::cout << "SCAN:"
           << " stn " << msg.station_id()
@@ -93,6 +92,9 @@ int main(int argc, char const* argv[])
 
     con.connect("rowlf.bom.gov.au", "15555");
 
+    // reuse a single scan object to avoid reallocating storage for every message
+    rapic::scan scan;
+
     // loop forever as long as the connection stays open
     while (con.connection_state() != rapic::connection_state::disconnected)
     {
@@ -101,10 +103,10 @@ int main(int argc, char const* argv[])
 
       // process socket traffic and handle messages until socket runs dry
       while (con.process_traffic())
-        handle_rapic_messages(con);
+        handle_rapic_messages(con, scan);
 
       // handle remaining messages and return to polling
-      handle_rapic_messages(con);
+      handle_rapic_messages(con, scan);
     }
   }
   catch (std::exception& err)
@@ -24,6 +24,7 @@ auto rapic::write_odim_h5_volume(
       std::string const& path
     , std::list<scan> const& scan_set
     , std::function<void(char const*)> log_fn
+    , odim_options const& options
     ) -> time_t
 {
   throw std::logic_error{"rapic library compiled without ODIM support"};
@@ -32,6 +33,7 @@ auto rapic::write_odim_h5_volume(
 #else
 
 #include <odim_h5.h>
+#include <algorithm>
 #include <cmath>
 #include <cstring>
 #include <map>
@@ -100,57 +102,57 @@ static std::map<std::string, quantity> const video_map =
 
 using odim_meta_fn = void (*)(header const&, meta_extra&);
 #define METAFN [](header const& h, meta_extra& m)
-static std::map<std::string, odim_meta_fn> const header_map =
+static std::map<header_id, odim_meta_fn> const header_map =
 {
   // volume persistent metadata
-    { "STNID",        METAFN { }} // ignored - special processing
-  , { "NAME",         METAFN { }} // ignored - special processing
-  , { "STN_NUM",      METAFN { }} // ignored - special processing
-  , { "WMONUMBER",    METAFN { }} // ignored - special processing
-  , { "COUNTRY",      METAFN { }} // ignored - special processing
-  , { "IMGFMT",       METAFN { }} // ignored - implicit in ODIM_H5 product type
-  , { "LATITUDE",     METAFN { }} // ignored - special processing
-  , { "LONGITUDE",    METAFN { }} // ignored - special processing
-  , { "HEIGHT",       METAFN { }} // ignored - special processing
-  , { "RADARTYPE",    METAFN { m.v.attributes()["system"].set(h.value()); }}
-  , { "PRODUCT",      METAFN { m.v.attributes()["rapic_PRODUCT"].set(h.value()); }}
-  , { "VOLUMEID",     METAFN { m.v.attributes()["rapic_VOLUMEID"].set(h.get_integer()); }}
-  , { "BEAMWIDTH",    METAFN { m.v.attributes()["beamwidth"].set(h.get_real()); }}
-  , { "HBEAMWIDTH",   METAFN { m.v.attributes()["beamwH"].set(h.get_real()); }}
-  , { "VBEAMWIDTH",   METAFN { m.v.attributes()["beamwV"].set(h.get_real()); }}
-  , { "FREQUENCY",    METAFN
+    { header_id::stnid,        METAFN { }} // ignored - special processing
+  , { header_id::name,         METAFN { }} // ignored - special processing
+  , { header_id::stn_num,      METAFN { }} // ignored - special processing
+  , { header_id::wmonumber,    METAFN { }} // ignored - special processing
+  , { header_id::country,      METAFN { }} // ignored - special processing
+  , { header_id::imgfmt,       METAFN { }} // ignored - implicit in ODIM_H5 product type
+  , { header_id::latitude,     METAFN { }} // ignored - special processing
+  , { header_id::longitude,    METAFN { }} // ignored - special processing
+  , { header_id::height,       METAFN { }} // ignored - special processing
+  , { header_id::radartype,    METAFN { m.v.attributes()["system"].set(h.value()); }}
+  , { header_id::product,      METAFN { m.v.attributes()["rapic_PRODUCT"].set(h.value()); }}
+  , { header_id::volumeid,     METAFN { m.v.attributes()["rapic_VOLUMEID"].set(h.get_integer()); }}
+  , { header_id::beamwidth,    METAFN { m.v.attributes()["beamwidth"].set(h.get_real()); }}
+  , { header_id::hbeamwidth,   METAFN { m.v.attributes()["beamwH"].set(h.get_real()); }}
+  , { header_id::vbeamwidth,   METAFN { m.v.attributes()["beamwV"].set(h.get_real()); }}
+  , { header_id::frequency,    METAFN
       {
         auto freq = h.get_real();
         m.v.attributes()["rapic_FREQUENCY"].set(freq);
         m.v.attributes()["wavelength"].set((299792458.0 / (freq * 1000000.0)) * 100.0);
       }
     }
-  , { "TXFREQUENCY",  METAFN
+  , { header_id::txfrequency,  METAFN
       {
         auto freq = h.get_real();
         m.v.attributes()["rapic_FREQUENCY"].set(freq);
         m.v.attributes()["wavelength"].set((299792458.0 / (freq * 1000000.0)) * 100.0);
       }
     }
-  , { "VERS",         METAFN { m.v.attributes()["sw_version"].set(h.value()); }}
-  , { "COPYRIGHT",    METAFN { m.v.attributes()["copyright"].set(h.value()); }} // non-standard
-  , { "ANGLERATE",    METAFN { m.v.attributes()["rpm"].set(h.get_real() * 60.0 / 360.0); }}
-  , { "ANTDIAM",      METAFN { m.v.attributes()["rapic_ANTDIAM"].set(h.get_real()); }}
-  , { "ANTGAIN",      METAFN { m.v.attributes()["antgainH"].set(h.get_real()); }}
-  , { "AZCORR",       METAFN { m.v.attributes()["rapic_AZCORR"].set(h.get_real()); }}
-  , { "ELCORR",       METAFN { m.v.attributes()["rapic_ELCORR"].set(h.get_real()); }}
-  , { "RXNOISE_H",    METAFN { m.v.attributes()["nsampleH"].set(h.get_real()); }}
-  , { "RXNOISE_V",    METAFN { m.v.attributes()["nsampleV"].set(h.get_real()); }}
-  , { "RXGAIN_H",     METAFN { m.v.attributes()["rapic_RXGAIN_H"].set(h.get_real()); }}
-  , { "RXGAIN_V",     METAFN { m.v.attributes()["rapic_RXGAIN_V"].set(h.get_real()); }}
+  , { header_id::vers,         METAFN { m.v.attributes()["sw_version"].set(h.value()); }}
+  , { header_id::copyright,    METAFN { m.v.attributes()["copyright"].set(h.value()); }} // non-standard
+  , { header_id::anglerate,    METAFN { m.v.attributes()["rpm"].set(h.get_real() * 60.0 / 360.0); }}
+  , { header_id::antdiam,      METAFN { m.v.attributes()["rapic_ANTDIAM"].set(h.get_real()); }}
+  , { header_id::antgain,      METAFN { m.v.attributes()["antgainH"].set(h.get_real()); }}
+  , { header_id::azcorr,       METAFN { m.v.attributes()["rapic_AZCORR"].set(h.get_real()); }}
+  , { header_id::elcorr,       METAFN { m.v.attributes()["rapic_ELCORR"].set(h.get_real()); }}
+  , { header_id::rxnoise_h,    METAFN { m.v.attributes()["nsampleH"].set(h.get_real()); }}
+  , { header_id::rxnoise_v,    METAFN { m.v.attributes()["nsampleV"].set(h.get_real()); }}
+  , { header_id::rxgain_h,     METAFN { m.v.attributes()["rapic_RXGAIN_H"].set(h.get_real()); }}
+  , { header_id::rxgain_v,     METAFN { m.v.attributes()["rapic_RXGAIN_V"].set(h.get_real()); }}
 
   // tilt persistent metadata
-  , { "TIME",         METAFN { }} // ignored - rendundant due to TIMESTAMP
-  , { "DATE",         METAFN { }} // ignored - rendundant due to TIMESTAMP
-  , { "ENDRNG",       METAFN { }} // ignored - implicit in scan dimensions
-  , { "ANGRES",       METAFN { }} // ingored - implicit in scan dimensions
-  , { "TIMESTAMP",    METAFN { m.t.set_start_date_time(rapic_timestamp_to_time_t(h.value().c_str())); }}
-  , { "TILT",         METAFN
+  , { header_id::time,         METAFN { }} // ignored - rendundant due to TIMESTAMP
+  , { header_id::date,         METAFN { }} // ignored - rendundant due to TIMESTAMP
+  , { header_id::endrng,       METAFN { }} // ignored - implicit in scan dimensions
+  , { header_id::angres,       METAFN { }} // ingored - implicit in scan dimensions
+  , { header_id::timestamp,    METAFN { m.t.set_start_date_time(rapic_timestamp_to_time_t(h.value().c_str())); }}
+  , { header_id::tilt,         METAFN
       {
         long a, b;
         sscanf(h.value().c_str(), "%ld of %ld", &a, &b);
@@ -158,10 +160,10 @@ static std::map<std::string, odim_meta_fn> const header_map =
         m.t.attributes()["scan_count"].set(b);
       }
     }
-  , { "ELEV",         METAFN { m.t.set_elevation_angle(h.get_real()); }}
-  , { "RNGRES",       METAFN { m.t.set_range_scale(h.get_real()); }}
-  , { "STARTRNG",     METAFN { m.t.set_range_start(h.get_real() / 1000.0); }}
-  , { "NYQUIST",      METAFN
+  , { header_id::elev,         METAFN { m.t.set_elevation_angle(h.get_real()); }}
+  , { header_id::rngres,       METAFN { m.t.set_range_scale(h.get_real()); }}
+  , { header_id::startrng,     METAFN { m.t.set_range_start(h.get_real() / 1000.0); }}
+  , { header_id::nyquist,      METAFN
       {
         auto val = h.get_real();
         if (std::isnan(m.maxvel))
@@ -169,14 +171,14 @@ static std::map<std::string, odim_meta_fn> const header_map =
         m.t.attributes()["NI"].set(val);
       }
     }
-  , { "PRF",          METAFN { m.t.attributes()["highprf"].set(h.get_real()); }}
-  , { "HIPRF",        METAFN { m.t.attributes()["rapic_HIPRF"].set(h.value()); }}
-  , { "UNFOLDING",    METAFN
+  , { header_id::prf,          METAFN { m.t.attributes()["highprf"].set(h.get_real()); }}
+  , { header_id::hiprf,        METAFN { m.t.attributes()["rapic_HIPRF"].set(h.value()); }}
+  , { header_id::unfolding,    METAFN
       {
         m.t.attributes()["rapic_UNFOLDING"].set(h.value());
         if (h.value() != "None")
         {
-          if (auto p = m.s.find_header("PRF"))
+          if (auto p = m.s.find_header(header_id::prf))
           {
             int a, b;
             if (sscanf(h.value().c_str(), "%d:%d", &a, &b) != 2)
@@ -188,7 +190,7 @@ static std::map<std::string, odim_meta_fn> const header_map =
         }
       }
     }
-  , { "POLARISATION", METAFN
+  , { header_id::polarisation, METAFN
       {
         if (h.value() == "H")
           m.t.attributes()["polmode"].set("single-H");
@@ -200,35 +202,35 @@ static std::map<std::string, odim_meta_fn> const header_map =
           m.t.attributes()["polmode"].set(h.value());
       }
     }
-  , { "TXPEAKPWR",    METAFN { m.t.attributes()["peakpwr"].set(h.get_real()); }}
-  , { "PEAKPOWER",    METAFN { m.t.attributes()["peakpwr"].set(h.get_real()); }}
-  , { "PEAKPOWERH",   METAFN { m.t.attributes()["peakpwrH"].set(h.get_real()); }} // non-standard
-  , { "PEAKPOWERV",   METAFN { m.t.attributes()["peakpwrV"].set(h.get_real()); }} // non-standard
-  , { "PULSELENGTH",  METAFN { m.t.attributes()["pulsewidth"].set(h.get_real()); }}
-  , { "STCRANGE",     METAFN { m.t.attributes()["rapic_STCRANGE"].set(h.get_real()); }}
+  , { header_id::txpeakpwr,    METAFN { m.t.attributes()["peakpwr"].set(h.get_real()); }}
+  , { header_id::peakpower,    METAFN { m.t.attributes()["peakpwr"].set(h.get_real()); }}
+  , { header_id::peakpowerh,   METAFN { m.t.attributes()["peakpwrH"].set(h.get_real()); }} // non-standard
+  , { header_id::peakpowerv,   METAFN { m.t.attributes()["peakpwrV"].set(h.get_real()); }} // non-standard
+  , { header_id::pulselength,  METAFN { m.t.attributes()["pulsewidth"].set(h.get_real()); }}
+  , { header_id::stcrange,     METAFN { m.t.attributes()["rapic_STCRANGE"].set(h.get_real()); }}
 
   // per moment metadata
-  , { "VIDEOGAIN",    METAFN { m.vidgain = h.value(); m.d.attributes()["rapic_VIDEOGAIN"].set(m.vidgain); }} // special processing
-  , { "VIDEOOFFSET",  METAFN { m.vidoffset = h.value(); m.d.attributes()["rapic_VIDEOOFFSET"].set(m.vidoffset); }} // special processing
-  , { "VIDEO",        METAFN { m.video = h.value(); }} // special processing
-  , { "FAULT",        METAFN { m.d.attributes()["malfunc"].set(true); m.d.attributes()["radar_msg"].set(h.value()); }}
-  , { "CLEARAIR",     METAFN { m.d.attributes()["rapic_CLEARAIR"].set(h.value() == "ON"); }}
-  , { "PASS",         METAFN { }} // ignored - implicit
-  , { "VIDEOUNITS",   METAFN { m.d.attributes()["rapic_VIDEOUNITS"].set(h.value()); }} // mostly redundant, keep in case of unknown VIDEO
-  , { "VIDRES",       METAFN { m.vidres = h.get_integer(); m.d.attributes()["rapic_VIDRES"].set(m.vidres); }}
-  , { "DBZLVL",       METAFN { m.thresholds = h.get_real_array(); m.d.attributes()["rapic_DBZLVL"].set(m.thresholds); }}
-  , { "DBZCALDLVL",   METAFN { m.d.attributes()["rapic_DBZCALDLVL"].set(h.get_real_array()); }}
-  , { "DIGCALDLVL",   METAFN { m.d.attributes()["rapic_DIGCALDLVL"].set(h.get_real_array()); }}
-  , { "VELLVL",       METAFN { m.maxvel = h.get_real(); m.d.attributes()["rapic_VELLVL"].set(m.maxvel); }}
-  , { "NOISETHRESH",  METAFN { m.d.attributes()["rapic_NOISETHRESH"].set(h.get_real()); }}
-  , { "QC0",          METAFN { m.d.attributes()["rapic_QC0"].set(h.value()); }}
-  , { "QC1",          METAFN { m.d.attributes()["rapic_QC1"].set(h.value()); }}
-  , { "QC2",          METAFN { m.d.attributes()["rapic_QC2"].set(h.value()); }}
-  , { "QC3",          METAFN { m.d.attributes()["rapic_QC3"].set(h.value()); }}
-  , { "QC4",          METAFN { m.d.attributes()["rapic_QC4"].set(h.value()); }}
-  , { "QC5",          METAFN { m.d.attributes()["rapic_QC5"].set(h.value()); }}
-  , { "QC6",          METAFN { m.d.attributes()["rapic_QC6"].set(h.value()); }}
-  , { "QC7",          METAFN { m.d.attributes()["rapic_QC7"].set(h.value()); }}
+  , { header_id::videogain,    METAFN { m.vidgain = h.value(); m.d.attributes()["rapic_VIDEOGAIN"].set(m.vidgain); }} // special processing
+  , { header_id::videooffset,  METAFN { m.vidoffset = h.value(); m.d.attributes()["rapic_VIDEOOFFSET"].set(m.vidoffset); }} // special processing
+  , { header_id::video,        METAFN { m.video = h.value(); }} // special processing
+  , { header_id::fault,        METAFN { m.d.attributes()["malfunc"].set(true); m.d.attributes()["radar_msg"].set(h.value()); }}
+  , { header_id::clearair,     METAFN { m.d.attributes()["rapic_CLEARAIR"].set(h.value() == "ON"); }}
+  , { header_id::pass,         METAFN { }} // ignored - implicit
+  , { header_id::videounits,   METAFN { m.d.attributes()["rapic_VIDEOUNITS"].set(h.value()); }} // mostly redundant, keep in case of unknown VIDEO
+  , { header_id::vidres,       METAFN { m.vidres = h.get_integer(); m.d.attributes()["rapic_VIDRES"].set(m.vidres); }}
+  , { header_id::dbzlvl,       METAFN { m.thresholds = h.get_real_array(); m.d.attributes()["rapic_DBZLVL"].set(m.thresholds); }}
+  , { header_id::dbzcaldlvl,   METAFN { m.d.attributes()["rapic_DBZCALDLVL"].set(h.get_real_array()); }}
+  , { header_id::digcaldlvl,   METAFN { m.d.attributes()["rapic_DIGCALDLVL"].set(h.get_real_array()); }}
+  , { header_id::vellvl,       METAFN { m.maxvel = h.get_real(); m.d.attributes()["rapic_VELLVL"].set(m.maxvel); }}
+  , { header_id::noisethresh,  METAFN { m.d.attributes()["rapic_NOISETHRESH"].set(h.get_real()); }}
+  , { header_id::qc0,          METAFN { m.d.attributes()["rapic_QC0"].set(h.value()); }}
+  , { header_id::qc1,          METAFN { m.d.attributes()["rapic_QC1"].set(h.value()); }}
+  , { header_id::qc2,          METAFN { m.d.attributes()["rapic_QC2"].set(h.value()); }}
+  , { header_id::qc3,          METAFN { m.d.attributes()["rapic_QC3"].set(h.value()); }}
+  , { header_id::qc4,          METAFN { m.d.attributes()["rapic_QC4"].set(h.value()); }}
+  , { header_id::qc5,          METAFN { m.d.attributes()["rapic_QC5"].set(h.value()); }}
+  , { header_id::qc6,          METAFN { m.d.attributes()["rapic_QC6"].set(h.value()); }}
+  , { header_id::qc7,          METAFN { m.d.attributes()["rapic_QC7"].set(h.value()); }}
 };
 
 }
@@ -274,14 +276,26 @@ auto rapic::write_odim_h5_volume(
       std::string const& path
     , std::list<scan> const& scan_set
     , std::function<void(char const*)> log_fn
+    , odim_options const& options
     ) -> time_t
 {
   std::vector<uint8_t> ibuf;
   std::vector<int> level_convert;
+  uint8_t level_lut[256];
+  std::vector<int> ray_index;
+  std::vector<float> ray_index_azimuths;
+  bool ray_index_identity = false;
+  std::vector<uint8_t> row_filled;
 
   // sanity check
   if (scan_set.empty())
     throw std::runtime_error{"empty scan set"};
+  if (options.compression < -1 || options.compression > 9)
+    throw std::invalid_argument{"invalid ODIM compression level"};
+
+  // odim_h5 chooses the chunking and filters of each dataset itself, so we can't honour custom settings yet
+  if (options.chunk_rays != 0 || options.compression != -1 || options.shuffle)
+    log_fn("custom dataset creation options are not supported by odim_h5, using library defaults");
 
   // initialize the volume file
   auto hvol = odim_h5::polar_volume{path, odim_h5::file::io_mode::create};
@@ -299,7 +313,7 @@ auto rapic::write_odim_h5_volume(
 
     int ctyn = -1;
     char const* ctys = "AU";
-    if (auto p = scan_set.front().find_header("COUNTRY"))
+    if (auto p = scan_set.front().find_header(header_id::country))
     {
       if (p->get_integer() == 36)
       {
@@ -316,22 +330,22 @@ auto rapic::write_odim_h5_volume(
 
     pos += snprintf(buf + pos, 128 - pos, "RAD:%s%02d", ctys, scan_set.front().station_id());
 
-    if (auto p = scan_set.front().find_header("NAME"))
+    if (auto p = scan_set.front().find_header(header_id::name))
       pos += snprintf(buf + pos, 128 - pos, ",PLC:%s", p->value().c_str());
 
     if (ctyn != -1)
       pos += snprintf(buf + pos, 128 - pos, ",CTY:%03d", ctyn);
 
-    if (auto p = scan_set.front().find_header("WMONUMBER"))
+    if (auto p = scan_set.front().find_header(header_id::wmonumber))
       pos += snprintf(buf + pos, 128 - pos, ",WMO:%s", p->value().c_str());
 
-    if (auto p = scan_set.front().find_header("STN_NUM"))
+    if (auto p = scan_set.front().find_header(header_id::stn_num))
       pos += snprintf(buf + pos, 128 - pos, ",STN:%ld", p->get_integer());
 
     buf[127] = '\0';
     hvol.set_source(buf);
   }
-  if (auto p = scan_set.front().find_header("LATITUDE"))
+  if (auto p = scan_set.front().find_header(header_id::latitude))
   {
     hvol.set_latitude(p->get_real() * -1.0);
   }
@@ -340,7 +354,7 @@ auto rapic::write_odim_h5_volume(
     log_fn("missing LATITUDE header, using -999.0 as placeholder");
     hvol.set_latitude(-999.0);
   }
-  if (auto p = scan_set.front().find_header("LONGITUDE"))
+  if (auto p = scan_set.front().find_header(header_id::longitude))
   {
     hvol.set_longitude(p->get_real());
   }
@@ -349,7 +363,7 @@ auto rapic::write_odim_h5_volume(
     log_fn("missing LONGITUDE header, using -999.0 as placeholder");
     hvol.set_longitude(-999.0);
   }
-  if (auto p = scan_set.front().find_header("HEIGHT"))
+  if (auto p = scan_set.front().find_header(header_id::height))
   {
     hvol.set_height(p->get_real());
   }
@@ -368,8 +382,8 @@ auto rapic::write_odim_h5_volume(
     bool new_tilt = s == end_tilt;
     if (new_tilt)
     {
-      auto htilt = s->find_header("TILT");
-      auto helev = s->find_header("ELEV");
+      auto htilt = s->find_header(header_id::tilt);
+      auto helev = s->find_header(header_id::elev);
 
       // look ahead and find the end of this tilt, also noting the maximum number of bins
       header const* h = nullptr;
@@ -378,12 +392,12 @@ auto rapic::write_odim_h5_volume(
       while (end_tilt != scan_set.end())
       {
         bins = std::max(bins, end_tilt->bins());
-        if (htilt && (h = end_tilt->find_header("TILT")))
+        if (htilt && (h = end_tilt->find_header(header_id::tilt)))
         {
           if (htilt->value() != h->value())
             break;
         }
-        else if (helev && (h = end_tilt->find_header("ELEV")))
+        else if (helev && (h = end_tilt->find_header(header_id::elev)))
         {
           if (helev->value() != h->value())
             break;
@@ -409,7 +423,7 @@ auto rapic::write_odim_h5_volume(
     meta_extra m{*s, hvol, hscan, hdata};
     for (auto& h : s->headers())
     {
-      auto i = header_map.find(h.name());
+      auto i = header_map.find(h.id());
       if (i == header_map.end())
       {
         log_fn(("unknown rapic header encountered: " + h.name() + " = " + h.value()).c_str());
@@ -446,7 +460,7 @@ auto rapic::write_odim_h5_volume(
           // use start time from next scan if available
           auto n = s; ++n;
           header const* h;
-          if (n != scan_set.end() && (h = n->find_header("TIMESTAMP")))
+          if (n != scan_set.end() && (h = n->find_header(header_id::timestamp)))
             hscan.set_end_date_time(rapic_timestamp_to_time_t(h->value().c_str()));
           else
             // last resort.  just add 30 seconds to start time to prevent violation of ODIM spec
@@ -460,9 +474,9 @@ auto rapic::write_odim_h5_volume(
     if (m.video.empty())
     {
       // it's a known issue on V8.22
-      auto vers = s->find_header("VERS");
+      auto vers = s->find_header(header_id::vers);
       if (!(vers && (vers->value() == "8.21" || vers->value() == "8.22")))
-        log_fn(("missing VIDEO header, assuming reflectivity (VERS: " + s->find_header("VERS")->value() + ")").c_str());
+        log_fn(("missing VIDEO header, assuming reflectivity (VERS: " + (vers ? vers->value() : "unknown") + ")").c_str());
       m.video = "Refl";
     }
 
@@ -477,17 +491,31 @@ auto rapic::write_odim_h5_volume(
     hdata.set_nodata(0.0);
     hdata.set_undetect(0.0);
 
-    // convert rays from received order and possibly range truncated, to CW from north order full range
-    std::fill(ibuf.begin(), ibuf.end(), 0);
-    for (size_t r = 0; r < s->ray_headers().size(); ++r)
+    // determine the output row of each ray
+    /* the passes of a tilt normally share the same ray azimuths, so the mapping is only recalculated at the start
+     * of each tilt or when the azimuths differ from those of the previous pass */
+    auto& rays = s->ray_headers();
+    if (   new_tilt
+        || rays.size() != ray_index_azimuths.size()
+        || !std::equal(
+                rays.begin()
+              , rays.end()
+              , ray_index_azimuths.begin()
+              , [](ray_header const& r, float azi) { return r.azimuth() == azi; }))
     {
-      std::memcpy(
-            &ibuf[angle_to_index(*s, s->ray_headers()[r].azimuth()) * bins]
-          , &s->level_data()[r * s->bins()]
-          , s->bins() * sizeof(uint8_t));
+      ray_index.resize(rays.size());
+      ray_index_azimuths.resize(rays.size());
+      ray_index_identity = static_cast<int>(rays.size()) == s->rays();
+      for (size_t r = 0; r < rays.size(); ++r)
+      {
+        ray_index[r] = angle_to_index(*s, rays[r].azimuth());
+        ray_index_azimuths[r] = rays[r].azimuth();
+        ray_index_identity = ray_index_identity && ray_index[r] == static_cast<int>(r);
+      }
     }
 
     // determine the conversion (if any) to real moment values
+    bool remap = false;
     // thresholded data?
     if (!m.thresholds.empty())
     {
@@ -518,19 +546,21 @@ auto rapic::write_odim_h5_volume(
         }
       }
 
-      // convert between the rapic and odim levels
-      for (size_t i = 0; i < ibuf.size(); ++i)
-      {
-        int lvl = ibuf[i];
-        if (lvl >= static_cast<int>(level_convert.size()))
-          throw std::runtime_error{"level exceeding threshold table size encountered"};
-        ibuf[i] = level_convert[lvl];
-      }
+      // check for levels beyond the end of the threshold table once using the maximum level present
+      auto data = s->level_data();
+      uint8_t max_level = 0;
+      for (size_t i = 0; i < rays.size() * s->bins(); ++i)
+        max_level = std::max(max_level, data[i]);
+      if (max_level >= level_convert.size())
+        throw std::runtime_error{"level exceeding threshold table size encountered"};
+
+      // build the lookup table used to convert between the rapic and odim levels
+      for (size_t i = 0; i < level_convert.size() && i < 256; ++i)
+        level_lut[i] = level_convert[i];
+      remap = true;
 
-      // write it out
       hdata.set_gain(vm->second.odim_gain);
       hdata.set_offset(vm->second.odim_offset);
-      hdata.write(ibuf.data());
     }
     // explicitly supplied gain and offset in rapic headers?
     else if (   !m.vidgain.empty() && m.vidgain != "THRESH"
@@ -542,7 +572,6 @@ auto rapic::write_odim_h5_volume(
       auto gain = std::stod(m.vidgain);
       hdata.set_gain(gain);
       hdata.set_offset(std::stod(m.vidoffset) + 0.5 * gain);
-      hdata.write(ibuf.data());
     }
     // velocity moment with nyquist or VELLVL supplied?
     else if (m.video == "Vel")
@@ -557,7 +586,6 @@ auto rapic::write_odim_h5_volume(
       // as above, we add half the gain to the rapic offset to get bin centers instead of minimums
       hdata.set_gain(gain);
       hdata.set_offset(offset + 0.5 * gain);
-      hdata.write(ibuf.data());
     }
     // otherwise we don't know what to do - just encode the levels directly
     else
@@ -565,8 +593,39 @@ auto rapic::write_odim_h5_volume(
       log_fn(("unable to determine encoding for VIDEO '" + m.video + "', writing levels directly").c_str());
       hdata.set_gain(1.0);
       hdata.set_offset(0.0);
-      hdata.write(ibuf.data());
     }
+
+    // if the scan is already in CW from north order at full range then write it without any copying
+    if (ray_index_identity && !remap && s->bins() == bins)
+    {
+      hdata.write(s->level_data());
+      continue;
+    }
+
+    // otherwise convert rays from received order and possibly range truncated, to CW from north order full range
+    /* each output row is written exactly once.  levels are remapped as they are copied and only the rows which were
+     * not received and the bins beyond the range of this pass are zero filled. */
+    row_filled.assign(s->rays(), 0);
+    for (size_t r = 0; r < rays.size(); ++r)
+    {
+      auto in = &s->level_data()[r * s->bins()];
+      auto out = &ibuf[ray_index[r] * bins];
+      if (remap)
+      {
+        for (int i = 0; i < s->bins(); ++i)
+          out[i] = level_lut[in[i]];
+      }
+      else
+        std::memcpy(out, in, s->bins() * sizeof(uint8_t));
+      std::memset(out + s->bins(), 0, (bins - s->bins()) * sizeof(uint8_t));
+      row_filled[ray_index[r]] = 1;
+    }
+    for (int r = 0; r < s->rays(); ++r)
+      if (!row_filled[r])
+        std::memset(&ibuf[r * bins], 0, bins * sizeof(uint8_t));
+
+    // write it out
+    hdata.write(ibuf.data());
   }
 
   return vol_time;
@@ -21,13 +21,23 @@
 #include <sys/types.h>
 #include <sys/select.h>
 #include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
 #include <netdb.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <poll.h>
 #include <algorithm>
 #include <cerrno>
+#include <chrono>
 #include <cmath>
+#include <clocale>
+#include <cstdio>
 #include <cstring>
 #include <ctime>
 #include <stdexcept>
@@ -35,12 +45,25 @@
 #include <system_error>
 #include <tuple>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 using namespace rapic;
 
 static constexpr auto fnan = std::numeric_limits<float>::quiet_NaN();
 
 static constexpr message_type no_message = static_cast<message_type>(-1);
 
+// maximum number of reads made by a single call to client::process_traffic()
+static constexpr int max_reads_per_call = 16;
+
+// time for which resolved server addresses are reused when reconnecting
+static constexpr time_t dns_cache_time = 300;
+
+// time to wait for a connection attempt to complete before trying the next address
+static constexpr time_t failover_timeout = 2;
+
 static const std::string msg_connect{"RPQUERY: SEMIPERMANENT CONNECTION - SEND ALL DATA TXCOMPLETESCANS=0\n"};
 static const std::string msg_keepalive{"RDRSTAT:\n"};
 static const std::string msg_mssg_head{"MSSG:"};
@@ -48,6 +71,8 @@ static const std::string msg_mssg_term{"\n"};
 static const std::string msg_mssg30_head{"MSSG: 30"};
 static const std::string msg_mssg30_term{"END STATUS\n"};
 static const std::string msg_scan_term{"END RADAR IMAGE"};
+static const std::string msg_query_head{"RPQUERY:"};
+static const std::string msg_filter_head{"RPFILTER:"};
 
 // this table translates the ASCII encoding absolute, RLE digits and delta lookups
 namespace
@@ -108,11 +133,393 @@ constexpr lookup_value lookup[] =
   lval(152),  lval(153),   lval(154),   lval(155),   lval(156),   lval(157),   lval(158),   lval(159)    // f8-ff
 };
 
+// count the leading bytes in the 0x80-0xff range (ascii encoded absolute levels 32-159)
+static auto ascii_high_run(uint8_t const* in, size_t size) -> size_t
+{
+  size_t run = 0;
+#ifdef __SSE2__
+  while (size - run >= 16)
+  {
+    auto mask = _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<__m128i const*>(in + run)));
+    if (mask != 0xffff)
+      return run + __builtin_ctz(~mask);
+    run += 16;
+  }
+#endif
+  while (run < size && in[run] >= 0x80)
+    ++run;
+  return run;
+}
+
+// convert a run of 0x80-0xff encoded absolute values into levels
+static auto ascii_high_decode(uint8_t const* in, size_t count, uint8_t* out) -> void
+{
+  size_t i = 0;
+#ifdef __SSE2__
+  auto bias = _mm_set1_epi8(0x60);
+  for (; count - i >= 16; i += 16)
+    _mm_storeu_si128(
+          reinterpret_cast<__m128i*>(out + i)
+        , _mm_sub_epi8(_mm_loadu_si128(reinterpret_cast<__m128i const*>(in + i)), bias));
+#endif
+  for (; i < count; ++i)
+    out[i] = in[i] - 0x60;
+}
+
+// find the first scan terminator at or after pos and return the position following it, or 0 if there is none
+static auto find_scan_end(uint8_t const* in, size_t size, size_t pos) -> size_t
+{
+  while (pos < size)
+  {
+    auto p = static_cast<uint8_t const*>(memchr(&in[pos], msg_scan_term[0], size - pos));
+    if (!p || static_cast<size_t>(&in[size] - p) < msg_scan_term.size())
+      break;
+    if (memcmp(p, msg_scan_term.data(), msg_scan_term.size()) == 0)
+      return p - in + msg_scan_term.size();
+    pos = p - in + 1;
+  }
+  return 0;
+}
+
+// find the end of the block of encoded rays starting at pos without decoding them
+/* this follows the same rules as scan::decode_rays() so that any headers following the rays are found in the same
+ * place.  ascii rays can only be ended by the end of scan marker (see the stray newline workaround in decode_rays)
+ * while binary rays are walked token by token to their 0,0 marker.  the returned position is that of the first
+ * character which is not part of the ray data, or 0 if the rays are truncated. */
+static auto find_rays_end(uint8_t const* in, size_t size, size_t pos) -> size_t
+{
+  for (; pos < size; ++pos)
+  {
+    auto next = in[pos];
+
+    // ascii encoded ray
+    if (next == '%')
+    {
+      auto end = find_scan_end(in, size, pos);
+      return end == 0 ? 0 : end - msg_scan_term.size();
+    }
+    // binary encoding
+    else if (next == '@')
+    {
+      if (pos + 19 >= size)
+        return 0;
+      size_t len = (in[pos + 17] << 8) | in[pos + 18];
+      pos += 19;
+      auto end = std::min(size, pos + len + 2);
+      while (true)
+      {
+        if (pos + 1 >= end)
+          return 0;
+        if (in[pos] > 1)
+          ++pos;
+        else if (in[pos + 1] != 0)
+          pos += 2;
+        else
+          break;
+      }
+      ++pos;
+    }
+    // anything else ends the ray data
+    else if (next > ' ')
+      return pos;
+  }
+  return pos;
+}
+
+// parse a number of the form [-+]ddd[.ddd] from the fixed width ray header field [pos, end)
+// leading spaces are skipped and on success pos is advanced past the number
+static auto parse_ray_number(uint8_t const*& pos, uint8_t const* end, bool fraction, float& val) -> bool
+{
+  static double const scale[] =
+  {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15
+  };
+
+  // ray header fields are short so the digits always fit exactly in the mantissa
+  if (end - pos > 15)
+    return false;
+
+  auto p = pos;
+  while (p < end && *p == ' ')
+    ++p;
+  bool neg = p < end && *p == '-';
+  if (p < end && (*p == '+' || *p == '-'))
+    ++p;
+
+  int64_t mant = 0;
+  int digits = 0, places = 0;
+  for (; p < end && *p >= '0' && *p <= '9'; ++p, ++digits)
+    mant = mant * 10 + (*p - '0');
+  if (fraction && p < end && *p == '.')
+    for (++p; p < end && *p >= '0' && *p <= '9'; ++p, ++digits, ++places)
+      mant = mant * 10 + (*p - '0');
+  if (digits == 0)
+    return false;
+
+  auto v = static_cast<float>(mant / scale[places]);
+  val = neg ? -v : v;
+  pos = p;
+  return true;
+}
+
+// locale independent parse of a base 10 integer, skipping leading whitespace as per strtol
+// on success pos is advanced past the number, on failure (including overflow) it is left unchanged
+static auto parse_integer(char const*& pos, long& val) -> bool
+{
+  auto p = pos;
+  while (*p == ' ' || (*p >= '\t' && *p <= '\r'))
+    ++p;
+  bool neg = *p == '-';
+  if (*p == '+' || *p == '-')
+    ++p;
+  if (*p < '0' || *p > '9')
+    return false;
+
+  unsigned long limit = neg ? -static_cast<unsigned long>(std::numeric_limits<long>::min()) : std::numeric_limits<long>::max();
+  unsigned long acc = 0;
+  for (; *p >= '0' && *p <= '9'; ++p)
+  {
+    unsigned digit = *p - '0';
+    if (acc > (limit - digit) / 10)
+      return false;
+    acc = acc * 10 + digit;
+  }
+
+  val = neg ? -static_cast<long>(acc - 1) - 1 : static_cast<long>(acc);
+  pos = p;
+  return true;
+}
+
+// locale independent parse of a real number, skipping leading whitespace as per strtod
+// decimal values with up to 19 significant digits and small exponents are converted exactly without calling strtod
+// (the mantissa and power of ten are both exactly representable so a single rounding is performed).  other forms
+// fall back to strtod_l using the C locale.  on failure pos is left unchanged.
+static auto parse_real(char const*& pos, double& val) -> bool
+{
+  static double const pow10[] =
+  {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+  };
+
+  auto p = pos;
+  while (*p == ' ' || (*p >= '\t' && *p <= '\r'))
+    ++p;
+  bool neg = *p == '-';
+  if (*p == '+' || *p == '-')
+    ++p;
+
+  // accumulate the significant digits
+  uint64_t mant = 0;
+  int digits = 0, exp = 0;
+  bool any = false, exact = true;
+  for (; *p >= '0' && *p <= '9'; ++p, any = true)
+  {
+    if (digits < 19)
+    {
+      mant = mant * 10 + (*p - '0');
+      digits += mant != 0;
+    }
+    else
+    {
+      exact &= *p == '0';
+      ++exp;
+    }
+  }
+  if (*p == '.')
+  {
+    for (++p; *p >= '0' && *p <= '9'; ++p, any = true)
+    {
+      if (digits < 19)
+      {
+        mant = mant * 10 + (*p - '0');
+        digits += mant != 0;
+        --exp;
+      }
+      else
+        exact &= *p == '0';
+    }
+  }
+
+  // optional exponent
+  if (any && (*p == 'e' || *p == 'E'))
+  {
+    auto q = p + 1;
+    bool eneg = *q == '-';
+    if (*q == '+' || *q == '-')
+      ++q;
+    if (*q >= '0' && *q <= '9')
+    {
+      int e = 0;
+      for (; *q >= '0' && *q <= '9'; ++q)
+        if (e < 100000)
+          e = e * 10 + (*q - '0');
+      exp += eneg ? -e : e;
+      p = q;
+    }
+  }
+
+  // fast path
+  if (any && exact && *p != 'x' && *p != 'X' && mant < (uint64_t(1) << 53) && exp >= -22 && exp <= 22)
+  {
+    double v = mant;
+    v = exp < 0 ? v / pow10[-exp] : v * pow10[exp];
+    val = neg ? -v : v;
+    pos = p;
+    return true;
+  }
+
+  // slow path for hexadecimal, infinity, nan, long mantissas and large exponents
+  static locale_t const c_locale = newlocale(LC_ALL_MASK, "C", static_cast<locale_t>(0));
+  if (c_locale == static_cast<locale_t>(0))
+    throw std::system_error{errno, std::system_category(), "rapic: failed to create C locale"};
+  char* end;
+  auto v = strtod_l(pos, &end, c_locale);
+  if (end == pos)
+    return false;
+  val = v;
+  pos = end;
+  return true;
+}
+
 auto rapic::release_tag() -> char const*
 {
   return RAPIC_RELEASE_TAG;
 }
 
+// names of the known headers, indexed by header_id (must be kept sorted)
+static std::string const header_names[] =
+{
+    "ANGLERATE", "ANGRES", "ANTDIAM", "ANTGAIN", "AZCORR", "BEAMWIDTH",
+    "CLEARAIR", "COPYRIGHT", "COUNTRY", "DATE", "DBZCALDLVL", "DBZLVL",
+    "DIGCALDLVL", "ELCORR", "ELEV", "ENDRNG", "FAULT", "FREQUENCY",
+    "HBEAMWIDTH", "HEIGHT", "HIPRF", "IMGFMT", "LATITUDE", "LONGITUDE",
+    "NAME", "NOISETHRESH", "NYQUIST", "PASS", "PEAKPOWER", "PEAKPOWERH",
+    "PEAKPOWERV", "POLARISATION", "PRF", "PRODUCT", "PULSELENGTH", "QC0",
+    "QC1", "QC2", "QC3", "QC4", "QC5", "QC6",
+    "QC7", "RADARTYPE", "RNGRES", "RXGAIN_H", "RXGAIN_V", "RXNOISE_H",
+    "RXNOISE_V", "STARTRNG", "STCRANGE", "STNID", "STN_NUM", "TILT",
+    "TIME", "TIMESTAMP", "TXFREQUENCY", "TXPEAKPWR", "UNFOLDING", "VBEAMWIDTH",
+    "VELLVL", "VERS", "VIDEO", "VIDEOGAIN", "VIDEOOFFSET", "VIDEOUNITS",
+    "VIDRES", "VOLUMEID", "WMONUMBER"
+};
+static_assert(
+      sizeof(header_names) / sizeof(header_names[0]) == static_cast<size_t>(header_id::count)
+    , "header_names does not match header_id");
+
+// known headers with numeric values which are parsed once when the value is set
+static std::bitset<static_cast<size_t>(header_id::count)> const numeric_headers = []
+{
+  std::bitset<static_cast<size_t>(header_id::count)> ret;
+  for (auto id :
+      { header_id::anglerate, header_id::angres, header_id::antdiam, header_id::antgain, header_id::azcorr
+      , header_id::beamwidth, header_id::dbzcaldlvl, header_id::dbzlvl, header_id::digcaldlvl, header_id::elcorr
+      , header_id::elev, header_id::endrng, header_id::frequency, header_id::hbeamwidth, header_id::height
+      , header_id::latitude, header_id::longitude, header_id::noisethresh, header_id::nyquist, header_id::peakpower
+      , header_id::peakpowerh, header_id::peakpowerv, header_id::prf, header_id::pulselength, header_id::rngres
+      , header_id::rxgain_h, header_id::rxgain_v, header_id::rxnoise_h, header_id::rxnoise_v, header_id::startrng
+      , header_id::stcrange, header_id::txfrequency, header_id::txpeakpwr, header_id::vbeamwidth, header_id::vellvl })
+    ret.set(static_cast<size_t>(id));
+  return ret;
+}();
+
+// parse a whitespace separated list of reals, returns false if the list is malformed
+static auto parse_real_array(char const* pos, std::vector<double>& out) -> bool
+{
+  out.clear();
+  while (*pos != '\0')
+  {
+    double val;
+    if (parse_real(pos, val))
+      out.push_back(val);
+    else
+    {
+      // check if it is just trailing spaces
+      while (*pos == ' ')
+        ++pos;
+      if (*pos != '\0')
+        return false;
+    }
+  }
+  return true;
+}
+
+auto rapic::lookup_header_id(char const* name, size_t len) -> header_id
+{
+  // binary search of the sorted name table
+  int lo = 0, hi = static_cast<int>(header_id::count) - 1;
+  while (lo <= hi)
+  {
+    auto mid = (lo + hi) / 2;
+    auto& cand = header_names[mid];
+    auto cmp = memcmp(name, cand.data(), std::min(len, cand.size()));
+    if (cmp == 0)
+      cmp = len < cand.size() ? -1 : len > cand.size() ? 1 : 0;
+    if (cmp == 0)
+      return static_cast<header_id>(mid);
+    if (cmp < 0)
+      hi = mid - 1;
+    else
+      lo = mid + 1;
+  }
+  return header_id::unknown;
+}
+
+auto rapic::header_name(header_id id) -> std::string const&
+{
+  if (id == header_id::unknown || id == header_id::count)
+    throw std::invalid_argument{"rapic: invalid header identifier"};
+  return header_names[static_cast<int>(id)];
+}
+
+header::header(std::string name, std::string value)
+  : id_{lookup_header_id(name)}
+  , value_(std::move(value))
+{
+  if (id_ == header_id::unknown)
+    name_ = std::move(name);
+  parse_value();
+}
+
+header::header(header_id id, std::string value)
+  : id_{id}
+  , value_(std::move(value))
+{
+  if (id_ == header_id::unknown || id_ == header_id::count)
+    throw std::invalid_argument{"rapic: invalid header identifier"};
+  parse_value();
+}
+
+auto header::set_name(std::string const& name) -> void
+{
+  assign_name(name.c_str(), name.size());
+  parse_value();
+}
+
+auto header::set_value(std::string const& value) -> void
+{
+  value_ = value;
+  parse_value();
+}
+
+auto header::assign_name(char const* name, size_t len) -> void
+{
+  id_ = lookup_header_id(name, len);
+  if (id_ == header_id::unknown)
+    name_.assign(name, len);
+  else
+    name_.clear();
+}
+
+auto header::parse_value() -> void
+{
+  parsed_ =
+       id_ != header_id::unknown
+    && numeric_headers.test(static_cast<size_t>(id_))
+    && parse_real_array(value_.c_str(), reals_)
+    && !reals_.empty();
+}
+
 auto header::get_boolean() const -> bool
 {
   if (   strcasecmp(value_.c_str(), "true") == 0
@@ -132,12 +539,23 @@ auto header::get_boolean() const -> bool
 
 auto header::get_integer() const -> long
 {
-  return std::stol(value_, nullptr, 10);
+  long val;
+  auto pos = value_.c_str();
+  if (!parse_integer(pos, val))
+    throw std::runtime_error{"bad integer value"};
+  return val;
 }
 
 auto header::get_real() const -> double
 {
-  return std::stod(value_);
+  if (parsed_)
+    return reals_.front();
+
+  double val;
+  auto pos = value_.c_str();
+  if (!parse_real(pos, val))
+    throw std::runtime_error{"bad double value"};
+  return val;
 }
 
 auto header::get_integer_array() const -> std::vector<long>
@@ -146,11 +564,10 @@ auto header::get_integer_array() const -> std::vector<long>
   auto pos = value_.c_str();
   while (*pos != '\0')
   {
-    char* end;
-    auto val = strtol(pos, &end, 10);
-
-    // did the conversion fail?
-    if (val == 0 && end == pos)
+    long val;
+    if (parse_integer(pos, val))
+      ret.push_back(val);
+    else
     {
       // check if it is just trailing spaces
       while (*pos == ' ')
@@ -158,39 +575,18 @@ auto header::get_integer_array() const -> std::vector<long>
       if (*pos != '\0')
         throw std::runtime_error{"bad integer value"};
     }
-    else
-    {
-      ret.push_back(val);
-      pos = end;
-    }
   }
   return ret;
 }
 
 auto header::get_real_array() const -> std::vector<double>
 {
-  std::vector<double> ret;
-  auto pos = value_.c_str();
-  while (*pos != '\0')
-  {
-    char* end;
-    auto val = strtod(pos, &end);
+  if (parsed_)
+    return reals_;
 
-    // did the conversion fail?
-    if (val == 0 && end == pos)
-    {
-      // check if it is just trailing spaces
-      while (*pos == ' ')
-        ++pos;
-      if (*pos != '\0')
-        throw std::runtime_error{"bad double value"};
-    }
-    else
-    {
-      ret.push_back(val);
-      pos = end;
-    }
-  }
+  std::vector<double> ret;
+  if (!parse_real_array(value_.c_str(), ret))
+    throw std::runtime_error{"bad double value"};
   return ret;
 }
 
@@ -201,11 +597,17 @@ scan::scan()
 
 auto scan::reset() -> void
 {
+  // keep the storage allocated for our headers so it can be reused by the next decode
+  for (auto& h : headers_)
+    spare_.push_back(std::move(h));
   headers_.clear();
+  std::fill(std::begin(header_index_), std::end(header_index_), -1);
   ray_headers_.clear();
   rays_ = 0;
   bins_ = 0;
   level_data_.clear();
+  deferred_data_.clear();
+  deferred_ = false;
 
   station_id_ = -1;
   volume_id_ = -1;
@@ -218,12 +620,16 @@ auto scan::reset() -> void
   angle_resolution_ = fnan;
 }
 
-auto scan::decode(uint8_t const* in, size_t size) -> size_t
-try
+auto scan::decode_rays(uint8_t const* in, size_t size, size_t pos) const -> size_t
 {
-  reset();
+  // if this is our first ray, allocate the data array
+  if (ray_headers_.empty())
+  {
+    ray_headers_.reserve(rays_);
+    level_data_.resize(rays_ * bins_);
+  }
 
-  for (size_t pos = 0; pos < size; ++pos)
+  for (; pos < size; ++pos)
   {
     auto next = in[pos];
 
@@ -232,10 +638,6 @@ try
     {
       ++pos;
 
-      // if this is our first ray, setup the data structures
-      if (ray_headers_.empty())
-        initialize_rays();
-
       // sanity check that we don't have too many rays
       if (static_cast<int>(ray_headers_.size()) == rays_)
         throw std::runtime_error{"scan data overflow (too many rays)"};
@@ -246,7 +648,8 @@ try
 
       // determine the ray angle
       float angle;
-      if (sscanf(reinterpret_cast<char const*>(&in[pos]), is_rhi_ ? "%4f" : "%3f", &angle) != 1)
+      auto hdr = &in[pos];
+      if (!parse_ray_number(hdr, hdr + (is_rhi_ ? 4 : 3), true, angle))
         throw std::runtime_error{"invalid ascii ray header"};
       pos += is_rhi_ ? 4 : 3;
 
@@ -259,6 +662,19 @@ try
       int bin = 0;
       while (pos < size)
       {
+        // fast path for runs of absolute values in the 0x80-0xff range which map linearly onto levels 32-159
+        if (in[pos] >= 0x80)
+        {
+          auto run = ascii_high_run(&in[pos], size - pos);
+          if (bin + static_cast<int>(run) > bins_)
+            throw std::runtime_error{"scan data overflow (ascii abs)"};
+          ascii_high_decode(&in[pos], run, &out[bin]);
+          pos += run;
+          bin += run;
+          prev = out[bin - 1];
+          continue;
+        }
+
         auto& cur = lookup[in[pos++]];
 
         //  absolute pixel value
@@ -273,15 +689,17 @@ try
         else if (cur.type == enc_type::digit)
         {
           auto count = cur.val;
-          while (pos < size && lookup[in[pos]].type == enc_type::digit)
+          while (pos < size && in[pos] >= '0' && in[pos] <= '9')
           {
             count *= 10;
-            count += lookup[in[pos++]].val;
+            count += in[pos++] - '0';
+            if (count > bins_)
+              throw std::runtime_error{"scan data overflow (ascii rle)"};
           }
           if (bin + count > bins_)
             throw std::runtime_error{"scan data overflow (ascii rle)"};
-          for (int i = 0; i < count; ++i)
-            out[bin++] = prev;
+          memset(&out[bin], prev, count);
+          bin += count;
         }
         // delta encoding
         // silently ignore potential overflow caused by second half of a delta encoding at end of ray
@@ -327,10 +745,6 @@ try
     {
       ++pos;
 
-      // if this is our first ray, setup the data structures
-      if (ray_headers_.empty())
-        initialize_rays();
-
       // sanity check that we don't have too many rays
       if (static_cast<int>(ray_headers_.size()) == rays_)
         throw std::runtime_error{"scan data overflow (too many rays)"};
@@ -339,26 +753,36 @@ try
       if (pos + 18 >= size)
         throw std::runtime_error{"corrupt scan detected (2)"};
 
-      // read the ray header
-      float azi, el;
-      int sec;
-      if (sscanf(reinterpret_cast<char const*>(&in[pos]), "%f,%f,%d=", &azi, &el, &sec) != 3)
+      // read the fixed width ray header "AAA.A,EEE.E,SSS="
+      float azi, el, sec;
+      auto hdr = &in[pos], hdr_end = hdr + 15;
+      if (   !parse_ray_number(hdr, hdr_end, true, azi) || hdr == hdr_end || *hdr++ != ','
+          || !parse_ray_number(hdr, hdr_end, true, el) || hdr == hdr_end || *hdr++ != ','
+          || !parse_ray_number(hdr, hdr_end, false, sec) || hdr != hdr_end || *hdr != '=')
         throw std::runtime_error("invalid binary ray header");
-      // note: we ignore the length for now
-      //auto len = (((unsigned int) in[16]) << 8) + ((unsigned int) in[17]);
+
+      // the 0,0 marker is the real end of the ray, the length field is only used to bound the decode
+      /* exactly what the length counts (leading '@', header, data, 0,0 terminator) is not well documented, so use the
+       * most generous interpretation as the bound: data bytes only, followed by the two byte terminator. */
+      size_t len = (in[pos + 16] << 8) | in[pos + 17];
       pos += 18;
+      auto end = std::min(size, pos + len + 2);
 
       // create the ray entry
-      ray_headers_.emplace_back(azi, el, sec);
+      ray_headers_.emplace_back(azi, el, static_cast<int>(sec));
 
       // decode the data into levels
       auto out = &level_data_[bins_ * (ray_headers_.size() - 1)];
       int bin = 0;
       while (true)
       {
+        if (pos >= end)
+          throw std::runtime_error{"scan data overflow (binary length)"};
         int val = in[pos++];
         if (val == 0 || val == 1)
         {
+          if (pos >= end)
+            throw std::runtime_error{"scan data overflow (binary length)"};
           int count = in[pos++];
           if (count == 0)
           {
@@ -367,8 +791,8 @@ try
           }
           if (bin + count > bins_)
             throw std::runtime_error{"scan data overflow (binary rle)"};
-          for (int i = 0; i < count; ++i)
-            out[bin++] = val;
+          memset(&out[bin], val, count);
+          bin += count;
         }
         else if (bin < bins_)
           out[bin++] = val;
@@ -376,6 +800,52 @@ try
           throw std::runtime_error{"scan data overflow (binary abs)"};
       }
     }
+    // anything else ends the ray data
+    else if (next > ' ')
+      break;
+  }
+
+  return pos;
+}
+
+auto scan::decode(uint8_t const* in, size_t size, decode_mode mode) -> size_t
+try
+{
+  reset();
+
+  for (size_t pos = 0; pos < size; ++pos)
+  {
+    auto next = in[pos];
+
+    // encoded rays
+    if (next == '%' || next == '@')
+    {
+      // if this is our first ray, setup the data structures
+      if (ray_headers_.empty())
+        initialize_rays();
+
+      if (mode == decode_mode::full)
+      {
+        // decode the rays and return to the header loop in case more headers follow
+        pos = decode_rays(in, size, pos) - 1;
+        continue;
+      }
+
+      // skip over the rays and return to the header loop in case more headers follow
+      auto end = find_rays_end(in, size, pos);
+      if (end == 0)
+        throw std::runtime_error{"corrupt scan detected (5)"};
+
+      // retain the ray data for lazy decoding
+      if (mode == decode_mode::lazy)
+      {
+        deferred_data_.insert(deferred_data_.end(), &in[pos], &in[end]);
+        deferred_ = true;
+      }
+
+      pos = end - 1;
+      continue;
+    }
     // header field
     else if (next > ' ')
     {
@@ -410,10 +880,24 @@ try
         if (in[pos4] < ' ') // note: spaces are valid characters in the header value
           break;
 
-      // store the header
-      headers_.emplace_back(
-            std::string(reinterpret_cast<char const*>(&in[pos]), pos2 - pos)
-          , std::string(reinterpret_cast<char const*>(&in[pos3]), pos4 - pos3));
+      // store the header (recycling the storage from a previous decode if available)
+      if (spare_.empty())
+      {
+        headers_.emplace_back(std::string{}, std::string{});
+      }
+      else
+      {
+        headers_.push_back(std::move(spare_.back()));
+        spare_.pop_back();
+      }
+      auto& h = headers_.back();
+      h.assign_name(reinterpret_cast<char const*>(&in[pos]), pos2 - pos);
+      h.value_.assign(reinterpret_cast<char const*>(&in[pos3]), pos4 - pos3);
+      h.parse_value();
+
+      // index known headers for fast lookup (first instance wins)
+      if (h.id_ != header_id::unknown && header_index_[static_cast<int>(h.id_)] == -1)
+        header_index_[static_cast<int>(h.id_)] = headers_.size() - 1;
 
       // advance past the header line
       pos = pos4;
@@ -423,51 +907,286 @@ try
   throw std::runtime_error{"corrupt scan detected (5)"};
 }
 catch (std::exception& err)
+{
+  rethrow_decode_error();
+}
+
+auto scan::decode_deferred() const -> void
+try
+{
+  deferred_ = false;
+  if (decode_rays(deferred_data_.data(), deferred_data_.size(), 0) != deferred_data_.size())
+    throw std::runtime_error{"corrupt scan detected (6)"};
+}
+catch (std::exception& err)
+{
+  // leave the scan without ray data so that the error is reported again upon the next access
+  ray_headers_.clear();
+  level_data_.clear();
+  deferred_ = true;
+  rethrow_decode_error();
+}
+
+auto scan::rethrow_decode_error() const -> void
 {
   std::ostringstream desc;
   desc << "failed to decode scan";
-  if (auto p = find_header("STNID"))
+  if (auto p = find_header(header_id::stnid))
     desc << " stnid: " << p->value();
-  if (auto p = find_header("NAME"))
+  if (auto p = find_header(header_id::name))
     desc << " name: " << p->value();
-  if (auto p = find_header("PRODUCT"))
+  if (auto p = find_header(header_id::product))
     desc << " product: " << p->value();
-  if (auto p = find_header("TILT"))
+  if (auto p = find_header(header_id::tilt))
     desc << " tilt: " << p->value();
-  if (auto p = find_header("PASS"))
+  if (auto p = find_header(header_id::pass))
     desc << " pass: " << p->value();
-  if (auto p = find_header("VIDEO"))
+  if (auto p = find_header(header_id::video))
     desc << " video: " << p->value();
   std::throw_with_nested(std::runtime_error{desc.str()});
 }
 
-auto scan::find_header(char const* name) const -> header const*
+auto scan::encode(std::vector<uint8_t>& out, ray_encoding encoding) const -> void
 {
-  for (auto& h : headers_)
-    if (h.name() == name)
-      return &h;
-  return nullptr;
-}
+  // ensure any lazily decoded ray data is available
+  auto& rays = ray_headers();
+  if (rays.empty() && rays_ > 0)
+    throw std::runtime_error{"rapic: unable to encode scan which was decoded without ray data"};
 
-auto scan::get_header_string(char const* name) const -> std::string const&
-{
-  if (auto p = find_header(name))
-    return p->value();
-  throw std::runtime_error{std::string("missing mandatory header ") + name};
-}
+  auto start = out.size();
+  try
+  {
+    // headers
+    for (auto& h : headers_)
+    {
+      auto& name = h.name();
+      out.insert(out.end(), name.begin(), name.end());
+      out.push_back(':');
+      out.push_back(' ');
+      out.insert(out.end(), h.value().begin(), h.value().end());
+      out.push_back('\n');
+    }
 
-auto scan::get_header_integer(char const* name) const -> long
-{
-  if (auto p = find_header(name))
-    return p->get_integer();
-  throw std::runtime_error{std::string("missing mandatory header ") + name};
+    // rays
+    if (encoding == ray_encoding::ascii)
+    {
+      if (!encode_ascii_rays(out))
+        throw std::runtime_error{"rapic: scan cannot be represented by the ascii encoding"};
+    }
+    else if (encoding == ray_encoding::binary)
+    {
+      encode_binary_rays(out);
+    }
+    else
+    {
+      // encode both ways and keep the smaller
+      /* the encoding is chosen for the whole scan rather than each ray, since the workaround for stray newlines
+       * in ASCII rays means that an ASCII ray immediately followed by a binary ray cannot be reliably decoded */
+      auto rays_start = out.size();
+      encode_binary_rays(out);
+      auto binary_size = out.size() - rays_start;
+      if (encode_ascii_rays(out) && out.size() - rays_start - binary_size < binary_size)
+        out.erase(out.begin() + rays_start, out.begin() + rays_start + binary_size);
+      else
+        out.resize(rays_start + binary_size);
+    }
+
+    // terminator
+    out.insert(out.end(), msg_scan_term.begin(), msg_scan_term.end());
+    out.push_back('\n');
+  }
+  catch (...)
+  {
+    out.resize(start);
+    throw;
+  }
 }
 
-auto scan::get_header_real(char const* name) const -> double
+auto scan::encode_ascii_rays(std::vector<uint8_t>& out) const -> bool
 {
-  if (auto p = find_header(name))
-    return p->get_real();
-  throw std::runtime_error{std::string("missing mandatory header ") + name};
+  // build the reverse of the decoding lookup table for absolute and delta values
+  struct ascii_table
+  {
+    uint8_t abs[160];
+    uint8_t delta[7][7];
+  };
+  static auto const table = []
+  {
+    ascii_table ret;
+    memset(&ret, 0, sizeof(ret));
+    for (int c = 255; c > 0; --c)
+    {
+      if (lookup[c].type == enc_type::value)
+        ret.abs[lookup[c].val] = c;
+      else if (lookup[c].type == enc_type::delta)
+        ret.delta[lookup[c].val + 3][lookup[c].val2 + 3] = c;
+    }
+    return ret;
+  }();
+
+  auto rollback = out.size();
+  char buf[16];
+  for (size_t r = 0; r < ray_headers_.size(); ++r)
+  {
+    // ray header
+    auto angle = ray_headers_[r].azimuth();
+    auto scaled = is_rhi_ ? angle * 10.0 : angle;
+    if (!(scaled >= 0.0 && scaled < 1000.0 && std::abs(scaled - std::lround(scaled)) < 0.001))
+    {
+      out.resize(rollback);
+      return false;
+    }
+    if (is_rhi_)
+      snprintf(buf, sizeof(buf), "%%%04.1f", angle);
+    else
+      snprintf(buf, sizeof(buf), "%%%03ld", std::lround(angle));
+    out.insert(out.end(), buf, buf + strlen(buf));
+
+    // ray data with trailing zeros omitted
+    auto in = &level_data_[bins_ * r];
+    int len = bins_;
+    while (len > 0 && in[len - 1] == 0)
+      --len;
+
+    int prev = 0;
+    for (int bin = 0; bin < len; )
+    {
+      // run length encoding of the previous value
+      // note that a run always ends at a different value so two run lengths are never adjacent
+      int run = 0;
+      while (bin + run < len && in[bin + run] == prev)
+        ++run;
+      if (run >= 3)
+      {
+        auto digits = snprintf(buf, sizeof(buf), "%d", run);
+        out.insert(out.end(), buf, buf + digits);
+        bin += run;
+        continue;
+      }
+
+      // delta encoding of the next two values
+      if (bin + 1 < len)
+      {
+        int d1 = in[bin] - prev, d2 = in[bin + 1] - in[bin];
+        if (d1 >= -3 && d1 <= 3 && d2 >= -3 && d2 <= 3)
+        {
+          out.push_back(table.delta[d1 + 3][d2 + 3]);
+          prev = in[bin + 1];
+          bin += 2;
+          continue;
+        }
+      }
+
+      // absolute value
+      if (in[bin] >= 160)
+      {
+        out.resize(rollback);
+        return false;
+      }
+      out.push_back(table.abs[in[bin]]);
+      prev = in[bin];
+      ++bin;
+    }
+    out.push_back('\n');
+  }
+  return true;
+}
+
+auto scan::encode_binary_rays(std::vector<uint8_t>& out) const -> void
+{
+  // rays from ASCII encoded scans carry no elevation so fall back to the scan elevation
+  float elev = 0.0f;
+  if (auto p = find_header(header_id::elev))
+    elev = p->get_real();
+
+  char buf[32];
+  for (size_t r = 0; r < ray_headers_.size(); ++r)
+  {
+    // ray header
+    auto& ray = ray_headers_[r];
+    auto azi = ray.azimuth();
+    auto el = std::isnan(ray.elevation()) ? elev : ray.elevation();
+    auto sec = std::max(0, ray.time_offset());
+    if (   snprintf(buf, sizeof(buf), "@%05.1f,%05.1f,%03d=", azi, el, sec) != 17
+        || std::isnan(azi)
+        || std::isnan(el))
+      throw std::runtime_error{"rapic: ray header cannot be represented by the binary encoding"};
+    auto len_pos = out.size() + 17;
+    out.insert(out.end(), buf, buf + 17);
+    out.push_back(0);
+    out.push_back(0);
+
+    // ray data with trailing zeros omitted, levels 0 and 1 are always run length encoded
+    auto in = &level_data_[bins_ * r];
+    int len = bins_;
+    while (len > 0 && in[len - 1] == 0)
+      --len;
+    for (int bin = 0; bin < len; )
+    {
+      auto val = in[bin];
+      if (val > 1)
+      {
+        out.push_back(val);
+        ++bin;
+        continue;
+      }
+      int run = 1;
+      while (bin + run < len && run < 255 && in[bin + run] == val)
+        ++run;
+      out.push_back(val);
+      out.push_back(run);
+      bin += run;
+    }
+    out.push_back(0);
+    out.push_back(0);
+
+    // the length covers the header (excluding the '@'), the length field itself and the data
+    auto total = out.size() - (len_pos - 16);
+    if (total > 0xffff)
+      throw std::runtime_error{"rapic: ray too long for binary encoding"};
+    out[len_pos] = total >> 8;
+    out[len_pos + 1] = total & 0xff;
+  }
+}
+
+auto scan::find_header(char const* name) const -> header const*
+{
+  return find_header(name, strlen(name));
+}
+
+auto scan::find_header(char const* name, size_t len) const -> header const*
+{
+  // known headers are indexed directly
+  auto id = lookup_header_id(name, len);
+  if (id != header_id::unknown)
+    return find_header(id);
+
+  // otherwise fall back to a search of the unknown headers
+  for (auto& h : headers_)
+    if (h.id_ == header_id::unknown && h.name_.size() == len && h.name_.compare(0, len, name, len) == 0)
+      return &h;
+  return nullptr;
+}
+
+auto scan::get_header_string(header_id id) const -> std::string const&
+{
+  if (auto p = find_header(id))
+    return p->value();
+  throw std::runtime_error{"missing mandatory header " + header_name(id)};
+}
+
+auto scan::get_header_integer(header_id id) const -> long
+{
+  if (auto p = find_header(id))
+    return p->get_integer();
+  throw std::runtime_error{"missing mandatory header " + header_name(id)};
+}
+
+auto scan::get_header_real(header_id id) const -> double
+{
+  if (auto p = find_header(id))
+    return p->get_real();
+  throw std::runtime_error{"missing mandatory header " + header_name(id)};
 }
 
 auto scan::initialize_rays() -> void
@@ -475,22 +1194,22 @@ auto scan::initialize_rays() -> void
   // if this is our first ray, setup the data array
 
   // store the header fields which we cache
-  station_id_ = get_header_integer("STNID");
-  if (auto p = find_header("VOLUMEID"))
+  station_id_ = get_header_integer(header_id::stnid);
+  if (auto p = find_header(header_id::volumeid))
     volume_id_ = p->get_integer();
-  product_ = get_header_string("PRODUCT");
-  if (auto p = find_header("PASS"))
+  product_ = get_header_string(header_id::product);
+  if (auto p = find_header(header_id::pass))
   {
     if (sscanf(p->value().c_str(), "%d of %d", &pass_, &pass_count_) != 2)
       throw std::runtime_error{"invalid PASS header"};
   }
-  is_rhi_ = get_header_string("IMGFMT") == "RHI";
+  is_rhi_ = get_header_string(header_id::imgfmt) == "RHI";
 
   // get the mandatory characteristics needed to determine scan structure
-  angle_resolution_ = get_header_real("ANGRES");
-  double rngres = get_header_real("RNGRES");
-  double startrng = get_header_real("STARTRNG");
-  double endrng = get_header_real("ENDRNG");
+  angle_resolution_ = get_header_real(header_id::angres);
+  double rngres = get_header_real(header_id::rngres);
+  double startrng = get_header_real(header_id::startrng);
+  double endrng = get_header_real(header_id::endrng);
 
   // if start/end angles are provided, use them to limit our ray count
   int inc = 1;
@@ -519,39 +1238,265 @@ auto scan::initialize_rays() -> void
   level_data_.resize(rays_ * bins_);
 }
 
+// create an anonymous file to hold the ring buffer memory
+/* memfd_create is called via syscall since the glibc wrapper is only available from 2.27.  kernels older than 3.17
+ * lack the call entirely, so fall back to a shared memory object that is unlinked as soon as it is opened. */
+static auto create_buffer_file() -> int
+{
+  int fd;
+
+#ifdef SYS_memfd_create
+  fd = syscall(SYS_memfd_create, "rapic", 0);
+  if (fd != -1 || errno != ENOSYS)
+    return fd;
+#endif
+
+  static std::atomic<unsigned> counter{0};
+  char name[64];
+  snprintf(name, sizeof(name), "/rapic-%d-%u", static_cast<int>(getpid()), counter++);
+  fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd != -1)
+    shm_unlink(name);
+  return fd;
+}
+
+// allocate a ring buffer which is mapped twice in adjacent virtual memory so that any span of up to size bytes
+// starting within the first mapping is contiguous regardless of where it wraps.  if a directory is supplied the
+// buffer is backed by an unnamed temporary file in that directory, otherwise it is backed by memory.
+static auto map_ring_buffer(size_t size, std::string const& dir = {}) -> uint8_t*
+{
+  auto fd = dir.empty() ? create_buffer_file() : open(dir.c_str(), O_TMPFILE | O_RDWR | O_EXCL, 0600);
+  if (fd == -1)
+    throw std::system_error{errno, std::system_category(), "rapic: failed to create buffer"};
+  if (ftruncate(fd, size) == -1)
+  {
+    auto err = errno;
+    close(fd);
+    throw std::system_error{err, std::system_category(), "rapic: failed to size buffer"};
+  }
+
+  // reserve the address space for both mappings, then map the buffer over each half
+  auto base = static_cast<uint8_t*>(mmap(nullptr, size * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+  if (base == MAP_FAILED)
+  {
+    auto err = errno;
+    close(fd);
+    throw std::system_error{err, std::system_category(), "rapic: failed to map buffer"};
+  }
+  if (   mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED
+      || mmap(base + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+  {
+    auto err = errno;
+    munmap(base, size * 2);
+    close(fd);
+    throw std::system_error{err, std::system_category(), "rapic: failed to map buffer"};
+  }
+
+  // the mappings keep the memory alive
+  close(fd);
+
+  return base;
+}
+
+// add to a counter which is only ever written by the calling thread
+/* a relaxed load and store avoids the cost of a locked read-modify-write on the hot path */
+static inline auto add_stat(std::atomic<uint64_t>& counter, uint64_t val) -> void
+{
+  counter.store(counter.load(std::memory_order_relaxed) + val, std::memory_order_relaxed);
+}
+
+static inline auto monotonic_ns() -> uint64_t
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+namespace
+{
+  // accumulates the time spent in a scope into a counter
+  struct scoped_timer
+  {
+    scoped_timer(std::atomic<uint64_t>& total) : total(total), start{monotonic_ns()} { }
+    ~scoped_timer() { add_stat(total, monotonic_ns() - start); }
+
+    std::atomic<uint64_t>&  total;
+    uint64_t                start;
+  };
+}
+
+// address lookup performed on a background thread
+/* the lookup thread holds its own reference to this object so that the client may be destroyed, moved or
+ * disconnected while a lookup is outstanding without waiting for getaddrinfo to return. */
+struct client::resolver
+{
+  resolver(std::string address, std::string service);
+  ~resolver();
+
+  auto run() -> void;
+
+  std::string           address;
+  std::string           service;
+  int                   fd;         // eventfd which becomes readable once the lookup is done
+  std::atomic_bool      done;       // set once the result is available
+  int                   error;      // getaddrinfo error code
+  std::vector<endpoint> endpoints;  // resolved addresses
+};
+
+client::resolver::resolver(std::string address, std::string service)
+  : address(std::move(address))
+  , service(std::move(service))
+  , fd{eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)}
+  , done{false}
+  , error{0}
+{
+  if (fd == -1)
+    throw std::system_error{errno, std::system_category(), "rapic: eventfd creation failed"};
+}
+
+client::resolver::~resolver()
+{
+  close(fd);
+}
+
+auto client::resolver::run() -> void
+{
+  // lookup the host
+  addrinfo hints, *addr = nullptr;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_flags = 0;
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  error = getaddrinfo(address.c_str(), service.c_str(), &hints, &addr);
+  if (error == 0 && addr == nullptr)
+    error = EAI_NONAME;
+
+  if (error == 0)
+  {
+    // split the addresses by family, keeping the preference order given by getaddrinfo
+    std::vector<endpoint> first, other;
+    for (auto ai = addr; ai; ai = ai->ai_next)
+    {
+      auto data = reinterpret_cast<uint8_t const*>(ai->ai_addr);
+      auto& list = ai->ai_family == addr->ai_family ? first : other;
+      list.push_back(endpoint{ai->ai_family, ai->ai_socktype, ai->ai_protocol, {data, data + ai->ai_addrlen}});
+    }
+    freeaddrinfo(addr);
+
+    // alternate between address families so that a broken IPv6 (or IPv4) route cannot stall every attempt
+    for (size_t i = 0; i < first.size() || i < other.size(); ++i)
+    {
+      if (i < first.size())
+        endpoints.push_back(std::move(first[i]));
+      if (i < other.size())
+        endpoints.push_back(std::move(other[i]));
+    }
+  }
+
+  done = true;
+  eventfd_write(fd, 1);
+}
+
+client::counters::counters()
+  : connects{0}
+  , disconnects{0}
+  , bytes_received{0}
+  , bytes_sent{0}
+  , recv_calls{0}
+  , keepalives_sent{0}
+  , keepalive_replies{0}
+  , keepalive_rtt{0}
+  , keepalive_sent_at{0}
+  , mssgs_dequeued{0}
+  , scans_dequeued{0}
+  , buffer_full{0}
+  , buffer_grows{0}
+  , buffer_high_water{0}
+  , traffic_time{0}
+  , dequeue_time{0}
+  , decode_time{0}
+  , last_activity{0}
+{
+  for (auto& bucket : decode_histogram)
+    bucket = 0;
+}
+
+auto client::buffer_deleter::operator()(uint8_t* ptr) const -> void
+{
+  munmap(ptr, size * 2);
+}
+
 client::client(size_t buffer_size, time_t keepalive_period, time_t inactivity_timeout)
   : keepalive_period_{keepalive_period}
   , inactivity_timeout_{inactivity_timeout}
+  , rcvbuf_{0}
   , socket_{-1}
   , state_{rapic::connection_state::disconnected}
   , last_keepalive_{0}
   , last_activity_{0}
-  , buffer_{new uint8_t[buffer_size]}
+  , next_endpoint_{0}
+  , resolved_at_{0}
+  , attempt_start_{0}
+  , reconnect_min_{1}
+  , reconnect_max_{0}
+  , reconnect_delay_{1}
+  , reconnect_at_{0}
+  , stats_period_{60}
+  , last_stats_{0}
   , capacity_{buffer_size}
   , wcount_{0}
   , rcount_{0}
+  , discard_at_{0}
+  , discard_pending_{false}
   , cur_type_{no_message}
   , cur_size_{0}
-{ }
+  , search_term_{nullptr}
+  , search_pos_{0}
+{
+  // the mirrored mappings must be page aligned
+  size_t page = sysconf(_SC_PAGESIZE);
+  capacity_ = std::max<size_t>(1, (capacity_ + page - 1) / page) * page;
+  max_capacity_ = capacity_;
+  buffer_ = buffer{map_ring_buffer(capacity_), buffer_deleter{capacity_}};
+}
 
 client::client(client&& rhs) noexcept
   : address_(std::move(rhs.address_))
   , service_(std::move(rhs.service_))
-  , keepalive_period_(std::move(keepalive_period_))
-  , inactivity_timeout_(std::move(inactivity_timeout_))
+  , keepalive_period_(std::move(rhs.keepalive_period_))
+  , inactivity_timeout_(std::move(rhs.inactivity_timeout_))
+  , rcvbuf_{rhs.rcvbuf_}
   , filters_(std::move(rhs.filters_))
   , socket_{rhs.socket_}
   , state_{rhs.state_}
   , last_keepalive_{rhs.last_keepalive_}
   , last_activity_{rhs.last_activity_}
+  , resolver_(std::move(rhs.resolver_))
+  , endpoints_(std::move(rhs.endpoints_))
+  , next_endpoint_{rhs.next_endpoint_}
+  , resolved_at_{rhs.resolved_at_}
+  , attempt_start_{rhs.attempt_start_}
+  , reconnect_min_{rhs.reconnect_min_}
+  , reconnect_max_{rhs.reconnect_max_}
+  , reconnect_delay_{rhs.reconnect_delay_}
+  , reconnect_at_{rhs.reconnect_at_}
+  , stats_fn_(std::move(rhs.stats_fn_))
+  , stats_period_{rhs.stats_period_}
+  , last_stats_{rhs.last_stats_}
   , wbuffer_(std::move(rhs.wbuffer_))
   , buffer_(std::move(rhs.buffer_))
-  , capacity_{rhs.capacity_}
+  , capacity_{rhs.capacity_.load()}
+  , max_capacity_{rhs.max_capacity_}
+  , spill_dir_(std::move(rhs.spill_dir_))
   , wcount_{rhs.wcount_.load()}
   , rcount_{rhs.rcount_.load()}
+  , discard_at_{rhs.discard_at_.load()}
+  , discard_pending_{rhs.discard_pending_.load()}
   , cur_type_{std::move(rhs.cur_type_)}
   , cur_size_{std::move(rhs.cur_size_)}
+  , search_term_{rhs.search_term_}
+  , search_pos_{rhs.search_pos_}
 {
+  restore_stats(rhs.stats());
   rhs.socket_ = -1;
 }
 
@@ -561,18 +1506,38 @@ auto client::operator=(client&& rhs) noexcept -> client&
   service_ = std::move(rhs.service_);
   keepalive_period_ = std::move(rhs.keepalive_period_);
   inactivity_timeout_ = std::move(rhs.inactivity_timeout_);
+  rcvbuf_ = rhs.rcvbuf_;
   filters_ = std::move(rhs.filters_);
   socket_ = rhs.socket_;
   state_ = rhs.state_;
   last_keepalive_ = rhs.last_keepalive_;
   last_activity_ = rhs.last_activity_;
+  resolver_ = std::move(rhs.resolver_);
+  endpoints_ = std::move(rhs.endpoints_);
+  next_endpoint_ = rhs.next_endpoint_;
+  resolved_at_ = rhs.resolved_at_;
+  attempt_start_ = rhs.attempt_start_;
+  reconnect_min_ = rhs.reconnect_min_;
+  reconnect_max_ = rhs.reconnect_max_;
+  reconnect_delay_ = rhs.reconnect_delay_;
+  reconnect_at_ = rhs.reconnect_at_;
+  restore_stats(rhs.stats());
+  stats_fn_ = std::move(rhs.stats_fn_);
+  stats_period_ = rhs.stats_period_;
+  last_stats_ = rhs.last_stats_;
   wbuffer_ = std::move(rhs.wbuffer_);
   buffer_ = std::move(rhs.buffer_);
-  capacity_ = rhs.capacity_;
+  capacity_ = rhs.capacity_.load();
+  max_capacity_ = rhs.max_capacity_;
+  spill_dir_ = std::move(rhs.spill_dir_);
   wcount_ = rhs.wcount_.load();
   rcount_ = rhs.rcount_.load();
+  discard_at_ = rhs.discard_at_.load();
+  discard_pending_ = rhs.discard_pending_.load();
   cur_type_ = std::move(rhs.cur_type_);
   cur_size_ = std::move(rhs.cur_size_);
+  search_term_ = rhs.search_term_;
+  search_pos_ = rhs.search_pos_;
 
   rhs.socket_ = -1;
 
@@ -603,11 +1568,34 @@ auto client::add_filter(int station, std::string const& product, std::vector<std
   filters_.emplace_back(oss.str());
 }
 
+auto client::set_buffer_limit(size_t max_size, std::string spill_directory) -> void
+{
+  size_t page = sysconf(_SC_PAGESIZE);
+  max_capacity_ = std::max<size_t>(capacity_, (max_size + page - 1) / page * page);
+  spill_dir_ = std::move(spill_directory);
+}
+
+auto client::set_socket_buffer(size_t size) -> void
+{
+  rcvbuf_ = std::min<size_t>(size, std::numeric_limits<int>::max());
+}
+
+auto client::set_reconnect(time_t min_delay, time_t max_delay) -> void
+{
+  reconnect_min_ = std::max<time_t>(min_delay, 1);
+  reconnect_max_ = max_delay > 0 ? std::max(max_delay, reconnect_min_) : 0;
+  reconnect_delay_ = reconnect_min_;
+}
+
 auto client::connect(std::string address, std::string service) -> void
 {
-  if (state_ != rapic::connection_state::disconnected)
+  if (state_ != rapic::connection_state::disconnected && state_ != rapic::connection_state::waiting)
     throw std::runtime_error{"rapic: connect called while already connected"};
 
+  // only reuse cached addresses if we are connecting to the same server
+  if (address != address_ || service != service_)
+    endpoints_.clear();
+
   // store connection details
   address_ = std::move(address);
   service_ = std::move(service);
@@ -615,84 +1603,28 @@ auto client::connect(std::string address, std::string service) -> void
   // reset connection state
   wcount_ = 0;
   rcount_ = 0;
+  discard_pending_ = false;
+  search_term_ = nullptr;
+  search_pos_ = 0;
+  reconnect_delay_ = reconnect_min_;
 
-  // lookupt the host
-  addrinfo hints, *addr;
-  memset(&hints, 0, sizeof(hints));
-  hints.ai_flags = 0;
-  hints.ai_family = AF_UNSPEC;
-  hints.ai_socktype = SOCK_STREAM;
-  int ret = getaddrinfo(address_.c_str(), service_.c_str(), &hints, &addr);
-  if (ret != 0 || addr == nullptr)
-    throw std::runtime_error{"rapic: unable to resolve server address"};
-
-  // TODO - loop through all addresses?
-  if (addr->ai_next)
-  {
-
-  }
-
-  // create the socket
-  socket_ = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
-  if (socket_ == -1)
-  {
-    freeaddrinfo(addr);
-    throw std::system_error{errno, std::system_category(), "rapic: socket creation failed"};
-  }
-
-  // set non-blocking I/O
-  int flags = fcntl(socket_, F_GETFL);
-  if (flags == -1)
-  {
-    disconnect();
-    freeaddrinfo(addr);
-    throw std::system_error{errno, std::system_category(), "rapic: failed to read socket flags"};
-  }
-  if (fcntl(socket_, F_SETFL, flags | O_NONBLOCK) == -1)
+  try
   {
-    disconnect();
-    freeaddrinfo(addr);
-    throw std::system_error{errno, std::system_category(), "rapic: failed to set socket flags"};
+    begin_connect();
   }
-
-  // connect to the remote host
-  ret = ::connect(socket_, addr->ai_addr, addr->ai_addrlen);
-  if (ret < 0)
+  catch (...)
   {
-    if (errno != EINPROGRESS)
-    {
-      disconnect();
-      freeaddrinfo(addr);
-      throw std::system_error{errno, std::system_category(), "rapic: failed to establish connection"};
-    }
-    state_ = rapic::connection_state::in_progress;
+    drop();
+    throw;
   }
-  else
-    state_ = rapic::connection_state::established;
-
-  // clean up the address list allocated by getaddrinfo
-  freeaddrinfo(addr);
-
-  // set the last activity to now so we don't immediately timeout
-  last_activity_ = time(NULL);
-
-  // queue up our permanent connection and filter messages for output as soon as we connect
-  /* note: since the only things we ever send is the initial connection, the filters and occasional keepalive
-   *       messages, we don't bother with complex write buffering.  the buffer is a simple string which will
-   *       be empty except for keepalives after the initial connection negotiation. */
-  wbuffer_.assign(msg_connect);
-  for (auto& filter : filters_)
-    wbuffer_.append(filter);
 }
 
 auto client::disconnect() -> void
 {
-  if (socket_ != -1)
-    close(socket_);
-  socket_ = -1;
+  // abandon any lookup in progress, the lookup thread will clean up after itself
+  resolver_.reset();
+  close_socket();
   state_ = rapic::connection_state::disconnected;
-  last_keepalive_ = 0;
-  wbuffer_.clear();
 }
 
 auto client::connection_state() const -> rapic::connection_state
@@ -702,12 +1634,12 @@ auto client::connection_state() const -> rapic::connection_state
 
 auto client::pollable_fd() const -> int
 {
-  return socket_;
+  return state_ == rapic::connection_state::resolving ? resolver_->fd : socket_;
 }
 
 auto client::poll_read() const -> bool
 {
-  return state_ == rapic::connection_state::established;
+  return state_ == rapic::connection_state::established || state_ == rapic::connection_state::resolving;
 }
 
 auto client::poll_write() const -> bool
@@ -720,8 +1652,17 @@ auto client::poll(int timeout) const -> void
   if (state_ == rapic::connection_state::disconnected)
     throw std::runtime_error{"rapic: attempt to poll while disconnected"};
 
+  // no socket to wait on, just sleep until our next connection attempt is due
+  if (state_ == rapic::connection_state::waiting)
+  {
+    // a negative timeout means no limit
+    auto delay = std::max<time_t>(reconnect_at_ - time(NULL), 0) * 1000;
+    ::poll(nullptr, 0, timeout < 0 ? delay : std::min<time_t>(delay, timeout));
+    return;
+  }
+
   struct pollfd fds;
-  fds.fd = socket_;
+  fds.fd = pollable_fd();
   fds.events = POLLRDHUP | (poll_read() ? POLLIN : 0) | (poll_write() ? POLLOUT : 0);
   ::poll(&fds, 1, timeout);
 }
@@ -751,31 +1692,72 @@ static auto is_socket_writeable(int socket) -> bool
 auto client::process_traffic() -> bool
 try
 {
+  scoped_timer timer{stats_.traffic_time};
+
   // sanity check
   if (state_ == rapic::connection_state::disconnected)
     return false;
 
+  // time to reconnect?
+  if (state_ == rapic::connection_state::waiting)
+  {
+    // wait for the reader to discard the remains of the lost connection before new data arrives
+    if (discard_pending_ || time(NULL) < reconnect_at_)
+      return false;
+
+    begin_connect();
+  }
+
+  // waiting for our address lookup to complete?
+  if (state_ == rapic::connection_state::resolving)
+  {
+    if (!resolver_->done)
+      return false;
+
+    finish_resolve();
+  }
+
   // need to check our connection attempt progress
   if (state_ == rapic::connection_state::in_progress)
   {
+    // give up on this address sooner if there are others left to try
+    auto more = next_endpoint_ + 1 < endpoints_.size();
+    auto timeout = more ? failover_timeout : inactivity_timeout_;
+
     /* SO_ERROR is only set once the socket is writeable, so manually check via select that it is.
      * without this check clients can call process_traffic() before the socket is writeable and cause
      * the connection to look established before it really is. */
+    int res = 0;
     if (!is_socket_writeable(socket_))
-      return false;
-
-    // get the socket error status
-    int res = 0; socklen_t len = sizeof(res);
-    if (getsockopt(socket_, SOL_SOCKET, SO_ERROR, &res, &len) < 0)
-      throw std::system_error{errno, std::system_category(), "rapic: getsockopt failure"};
+    {
+      if (time(NULL) - attempt_start_ <= timeout)
+        return false;
+      res = ETIMEDOUT;
+    }
+    else
+    {
+      // get the socket error status
+      socklen_t len = sizeof(res);
+      if (getsockopt(socket_, SOL_SOCKET, SO_ERROR, &res, &len) < 0)
+        throw std::system_error{errno, std::system_category(), "rapic: getsockopt failure"};
 
-    // not connected yet?
-    if (res == EINPROGRESS)
-      return false;
+      // not connected yet?
+      if (res == EINPROGRESS)
+        return false;
+    }
 
     // okay, connection attempt is complete.  did it succeed?
-    if (res < 0)
-      throw std::system_error{res, std::system_category(), "rapic: failed to establish connection (async)"};
+    if (res != 0)
+    {
+      if (!more)
+        throw std::system_error{res, std::system_category(), "rapic: failed to establish connection (async)"};
+
+      // fail over to the next address
+      close_socket();
+      ++next_endpoint_;
+      open_socket();
+      return false;
+    }
 
     state_ = rapic::connection_state::established;
   }
@@ -783,11 +1765,20 @@ try
   // get current time
   auto now = time(NULL);
 
+  // report our statistics
+  if (stats_fn_ && now - last_stats_ >= stats_period_)
+  {
+    last_stats_ = now;
+    stats_fn_(*this, stats());
+  }
+
   // do we need to send a keepalive? (ie: RDRSTAT)
   if (now - last_keepalive_ > keepalive_period_)
   {
     wbuffer_.append(msg_keepalive);
     last_keepalive_ = now;
+    add_stat(stats_.keepalives_sent, 1);
+    stats_.keepalive_sent_at.store(monotonic_ns(), std::memory_order_relaxed);
   }
 
   // write everything we can
@@ -795,7 +1786,8 @@ try
   {
     // write as much as we can
     ssize_t ret;
-    while ((ret = write(socket_, wbuffer_.c_str(), wbuffer_.size())) == -1)
+    // use send rather than write so that a dropped connection raises an error instead of SIGPIPE
+    while ((ret = send(socket_, wbuffer_.c_str(), wbuffer_.size(), MSG_NOSIGNAL)) == -1)
     {
       if (errno == EAGAIN || errno == EWOULDBLOCK)
       {
@@ -808,34 +1800,49 @@ try
 
     // remove the written data from the buffer
     wbuffer_.erase(0, ret);
+    add_stat(stats_.bytes_sent, ret);
   }
 
-  // read everything we can
-  while (true)
+  // the message handler thread may replace the buffer with a larger one, so hold it steady while we write
+  std::lock_guard<std::mutex> lock{buffer_mutex_};
+
+  // read everything we can, up to a limit so that other connections on this thread get a turn
+  for (int reads = 0; reads < max_reads_per_call; )
   {
     // if our buffer is full return and allow client to do some reading
     if (wcount_ - rcount_ == capacity_)
+    {
+      add_stat(stats_.buffer_full, 1);
       return true;
+    }
 
-    // determine current read and write positions
-    auto rpos = rcount_ % capacity_;
+    // determine current write position
     auto wpos = wcount_ % capacity_;
 
-    // see how much _contiguous_ space is left in our buffer (may be less than total available write space)
-    auto space = wpos < rpos ? rpos - wpos : capacity_ - wpos;
+    // the buffer is mirrored so all free space is contiguous from the write position
+    auto space = capacity_ - (wcount_ - rcount_);
 
     // read some data off the wire
     auto bytes = recv(socket_, &buffer_[wpos], space, 0);
+    add_stat(stats_.recv_calls, 1);
     if (bytes > 0)
     {
-      // reset our inactivity timeout
+      // reset our inactivity timeout and reconnection backoff
       last_activity_ = now;
+      stats_.last_activity.store(now, std::memory_order_relaxed);
+      reconnect_delay_ = reconnect_min_;
 
       // advance our write position
       wcount_ += bytes;
 
-      // if we read as much as we asked for there may be more still waiting so return true
-      return static_cast<size_t>(bytes) == space;
+      add_stat(stats_.bytes_received, bytes);
+      auto used = wcount_ - rcount_;
+      if (used > stats_.buffer_high_water.load(std::memory_order_relaxed))
+        stats_.buffer_high_water.store(used, std::memory_order_relaxed);
+
+      // keep reading until the socket is drained
+      /* the buffer is mirrored so the free space is always contiguous and a single recv fills all of it */
+      ++reads;
     }
     else if (bytes < 0)
     {
@@ -859,14 +1866,16 @@ try
     else /* if (bytes == 0) */
     {
       // connection has been closed normally by the remote side
-      disconnect();
+      drop();
       return false;
     }
   }
+  // we ran out of our read budget but there may be more still waiting so return true
+  return true;
 }
 catch (...)
 {
-  disconnect();
+  drop();
   throw;
 }
 
@@ -882,47 +1891,71 @@ auto client::service() const -> std::string const&
 
 auto client::dequeue(message_type& type) -> bool
 {
+  scoped_timer timer{stats_.dequeue_time};
+
   // move along to the next packet in the buffer if needed
   if (cur_type_ != no_message)
+  {
     rcount_ += cur_size_;
+    search_term_ = nullptr;
+    search_pos_ = 0;
+  }
 
   // reset our current type
   cur_type_ = no_message;
   cur_size_ = 0;
 
+  // cache write count to ensure consistent overflow check at the end of this function
+  auto wc = wcount_.load();
+
+  // if a connection was lost only look for messages that were completed before it was
+  auto discard = discard_pending_.load();
+  if (discard)
+    wc = discard_at_;
+
   // ignore leading whitespace (and return if no data at all)
   while (true)
   {
-    if (wcount_ == rcount_)
+    if (wc == rcount_)
+    {
+      if (discard)
+        discard_pending_ = false;
       return false;
+    }
     if (buffer_[rcount_ % capacity_] > 0x20)
       break;
     ++rcount_;
   }
 
-  // cache write count to ensure consistent overflow check at the end of this function
-  auto wc = wcount_.load();
-
   // is it an MSSG style message?
-  if (buffer_starts_with(msg_mssg_head))
+  if (buffer_starts_with(msg_mssg_head, wc))
   {
     // status 30 is multi-line terminated by "END STATUS"
-    if (buffer_starts_with(msg_mssg30_head))
+    if (buffer_starts_with(msg_mssg30_head, wc))
     {
-      if (buffer_find(msg_mssg30_term, cur_size_))
+      if (buffer_find(msg_mssg30_term, wc, cur_size_))
       {
         cur_type_ = type = message_type::mssg;
         cur_size_ += msg_mssg30_term.size();
+        add_stat(stats_.mssgs_dequeued, 1);
+
+        // the status message is the server's reply to our keepalive
+        if (auto sent = stats_.keepalive_sent_at.exchange(0, std::memory_order_relaxed))
+        {
+          stats_.keepalive_rtt.store(monotonic_ns() - sent, std::memory_order_relaxed);
+          add_stat(stats_.keepalive_replies, 1);
+        }
         return true;
       }
     }
     // otherwise assume it is a single line message and look for an end of line
     else
     {
-      if (buffer_find(msg_mssg_term, cur_size_))
+      if (buffer_find(msg_mssg_term, wc, cur_size_))
       {
         cur_type_ = type = message_type::mssg;
         cur_size_ += msg_mssg_term.size();
+        add_stat(stats_.mssgs_dequeued, 1);
         return true;
       }
     }
@@ -930,109 +1963,1290 @@ auto client::dequeue(message_type& type) -> bool
   // otherwise assume it is a scan message and look for "END RADAR IMAGE"
   else
   {
-    if (buffer_find(msg_scan_term, cur_size_))
+    if (buffer_find(msg_scan_term, wc, cur_size_))
     {
       cur_type_ = type = message_type::scan;
       cur_size_ += msg_scan_term.size();
+      add_stat(stats_.scans_dequeued, 1);
       return true;
     }
   }
 
-  // if the buffer is full but we still cannot read a message then we are in overflow, fail hard
-  if (wc - rcount_ == capacity_)
-    throw std::runtime_error{"rapic: buffer overflow (try increasing buffer size)"};
+  // anything left from the lost connection is an incomplete message which must be thrown away
+  if (discard)
+  {
+    rcount_ = wc;
+    search_term_ = nullptr;
+    search_pos_ = 0;
+    discard_pending_ = false;
+    return false;
+  }
+
+  // if the buffer is full but we still cannot read a message then grow it, or if we can't we are in overflow
+  if (wc - rcount_ == capacity_ && !buffer_grow())
+    throw std::runtime_error{"rapic: buffer overflow (try increasing buffer size or limit)"};
 
   return false;
 }
 
 auto client::decode(mssg& msg) -> void
 {
+  scoped_timer timer{stats_.decode_time};
   check_cur_type(message_type::mssg);
 
-  msg.content.reserve(cur_size_);
-
-  // if the message spans the buffer wrap around point, copy it into a temporary location to ease parsing
-  auto pos = rcount_ % capacity_;
-  if (pos + cur_size_ > capacity_)
-  {
-    msg.content.assign(reinterpret_cast<char const*>(&buffer_[pos]), capacity_ - pos);
-    msg.content.append(reinterpret_cast<char const*>(&buffer_[0]), cur_size_ - (capacity_ - pos));
-  }
-  else
-  {
-    msg.content.assign(reinterpret_cast<char const*>(&buffer_[pos]), cur_size_);
-  }
+  // the buffer is mirrored so the message is contiguous even if it spans the wrap around point
+  msg.content.assign(reinterpret_cast<char const*>(&buffer_[rcount_ % capacity_]), cur_size_);
 }
 
-auto client::decode(scan& msg) -> void
+auto client::decode(scan& msg, decode_mode mode) -> void
 {
   check_cur_type(message_type::scan);
 
-  auto pos = rcount_ % capacity_;
-  if (pos + cur_size_ > capacity_)
-  {
-    std::unique_ptr<uint8_t[]> buf{new uint8_t[cur_size_]};
-    std::memcpy(buf.get(), &buffer_[pos], capacity_ - pos);
-    std::memcpy(buf.get() + capacity_ - pos, &buffer_[0], cur_size_ - (capacity_ - pos));
-    msg.decode(buf.get(), cur_size_);
-  }
-  else
-    msg.decode(&buffer_[pos], cur_size_);
+  auto start = monotonic_ns();
+
+  // the buffer is mirrored so the message is contiguous even if it spans the wrap around point
+  msg.decode(&buffer_[rcount_ % capacity_], cur_size_, mode);
+
+  auto elapsed = monotonic_ns() - start;
+  add_stat(stats_.decode_time, elapsed);
+
+  // bucket 0 counts decodes under 2 microseconds, the last bucket everything longer than its lower bound
+  size_t bucket = 0;
+  for (auto us = elapsed / 1000; us > 1 && bucket < 15; us >>= 1)
+    ++bucket;
+  add_stat(stats_.decode_histogram[bucket], 1);
 }
 
-auto client::check_cur_type(message_type type) -> void
+auto client::decode_raw(std::vector<uint8_t>& raw) -> void
 {
-  if (cur_type_ != type)
-  {
-    if (cur_type_ == no_message)
-      throw std::runtime_error{"rapic: no message dequeued for decoding"};
+  scoped_timer timer{stats_.decode_time};
+  if (cur_type_ == no_message)
+    throw std::runtime_error{"rapic: no message dequeued for decoding"};
+
+  auto pos = &buffer_[rcount_ % capacity_];
+  raw.assign(pos, pos + cur_size_);
+}
+
+auto client::stats() const -> client_stats
+{
+  auto relaxed = std::memory_order_relaxed;
+  client_stats ret;
+  ret.connects = stats_.connects.load(relaxed);
+  ret.disconnects = stats_.disconnects.load(relaxed);
+  ret.bytes_received = stats_.bytes_received.load(relaxed);
+  ret.bytes_sent = stats_.bytes_sent.load(relaxed);
+  ret.recv_calls = stats_.recv_calls.load(relaxed);
+  ret.keepalives_sent = stats_.keepalives_sent.load(relaxed);
+  ret.keepalive_replies = stats_.keepalive_replies.load(relaxed);
+  ret.keepalive_rtt = stats_.keepalive_rtt.load(relaxed);
+  ret.mssgs_dequeued = stats_.mssgs_dequeued.load(relaxed);
+  ret.scans_dequeued = stats_.scans_dequeued.load(relaxed);
+  ret.buffer_full = stats_.buffer_full.load(relaxed);
+  ret.buffer_grows = stats_.buffer_grows.load(relaxed);
+  ret.buffer_capacity = capacity_;
+  ret.buffer_used = wcount_ - rcount_;
+  ret.buffer_high_water = stats_.buffer_high_water.load(relaxed);
+  ret.traffic_time = stats_.traffic_time.load(relaxed);
+  ret.dequeue_time = stats_.dequeue_time.load(relaxed);
+  ret.decode_time = stats_.decode_time.load(relaxed);
+  for (size_t i = 0; i < 16; ++i)
+    ret.decode_histogram[i] = stats_.decode_histogram[i].load(relaxed);
+  ret.last_activity = stats_.last_activity.load(relaxed);
+  return ret;
+}
+
+auto client::set_stats_callback(stats_fn fn, time_t period) -> void
+{
+  stats_fn_ = std::move(fn);
+  stats_period_ = period;
+  last_stats_ = 0;
+}
+
+auto client::restore_stats(client_stats const& val) -> void
+{
+  stats_.connects = val.connects;
+  stats_.disconnects = val.disconnects;
+  stats_.bytes_received = val.bytes_received;
+  stats_.bytes_sent = val.bytes_sent;
+  stats_.recv_calls = val.recv_calls;
+  stats_.keepalives_sent = val.keepalives_sent;
+  stats_.keepalive_replies = val.keepalive_replies;
+  stats_.keepalive_rtt = val.keepalive_rtt;
+  stats_.mssgs_dequeued = val.mssgs_dequeued;
+  stats_.scans_dequeued = val.scans_dequeued;
+  stats_.buffer_full = val.buffer_full;
+  stats_.buffer_grows = val.buffer_grows;
+  stats_.buffer_high_water = val.buffer_high_water;
+  stats_.traffic_time = val.traffic_time;
+  stats_.dequeue_time = val.dequeue_time;
+  stats_.decode_time = val.decode_time;
+  for (size_t i = 0; i < 16; ++i)
+    stats_.decode_histogram[i] = val.decode_histogram[i];
+  stats_.last_activity = val.last_activity;
+}
+
+auto client::begin_connect() -> void
+{
+  // use our cached addresses if they are still fresh, otherwise look them up again
+  if (endpoints_.empty() || time(NULL) - resolved_at_ > dns_cache_time)
+    start_resolve();
+  else
+  {
+    next_endpoint_ = 0;
+    open_socket();
+  }
+}
+
+auto client::start_resolve() -> void
+{
+  auto job = std::make_shared<resolver>(address_, service_);
+  std::thread{[job] { job->run(); }}.detach();
+  resolver_ = std::move(job);
+  state_ = rapic::connection_state::resolving;
+}
+
+auto client::finish_resolve() -> void
+{
+  auto job = std::move(resolver_);
+  if (job->error != 0)
+    throw std::runtime_error{std::string("rapic: unable to resolve server address: ") + gai_strerror(job->error)};
+
+  endpoints_ = std::move(job->endpoints);
+  resolved_at_ = time(NULL);
+  next_endpoint_ = 0;
+  open_socket();
+}
+
+auto client::open_socket() -> void
+{
+  // try each remaining address until one succeeds or is in progress
+  int err = 0;
+  for (; next_endpoint_ < endpoints_.size(); ++next_endpoint_)
+  {
+    auto& ep = endpoints_[next_endpoint_];
+    add_stat(stats_.connects, 1);
+
+    // create the socket
+    socket_ = socket(ep.family, ep.socktype, ep.protocol);
+    if (socket_ == -1)
+      throw std::system_error{errno, std::system_category(), "rapic: socket creation failed"};
+
+    // set non-blocking I/O
+    int flags = fcntl(socket_, F_GETFL);
+    if (flags == -1)
+    {
+      err = errno;
+      close_socket();
+      throw std::system_error{err, std::system_category(), "rapic: failed to read socket flags"};
+    }
+    if (fcntl(socket_, F_SETFL, flags | O_NONBLOCK) == -1)
+    {
+      err = errno;
+      close_socket();
+      throw std::system_error{err, std::system_category(), "rapic: failed to set socket flags"};
+    }
+
+    // enlarge the socket receive buffer if requested (must be before connect, failure is not fatal)
+    if (rcvbuf_ > 0)
+    {
+      int cur = 0; socklen_t len = sizeof(cur);
+      if (getsockopt(socket_, SOL_SOCKET, SO_RCVBUF, &cur, &len) == 0 && cur < rcvbuf_)
+        setsockopt(socket_, SOL_SOCKET, SO_RCVBUF, &rcvbuf_, sizeof(rcvbuf_));
+    }
+
+    // connect to the remote host
+    if (::connect(socket_, reinterpret_cast<sockaddr const*>(ep.addr.data()), ep.addr.size()) == 0)
+    {
+      state_ = rapic::connection_state::established;
+      break;
+    }
+    if (errno == EINPROGRESS)
+    {
+      state_ = rapic::connection_state::in_progress;
+      break;
+    }
+
+    // this address failed outright, move on to the next
+    err = errno;
+    close_socket();
+  }
+  if (socket_ == -1)
+    throw std::system_error{err, std::system_category(), "rapic: failed to establish connection"};
+
+  // set the last activity to now so we don't immediately timeout
+  attempt_start_ = last_activity_ = time(NULL);
+
+  // queue up our permanent connection and filter messages for output as soon as we connect
+  /* note: since the only things we ever send is the initial connection, the filters and occasional keepalive
+   *       messages, we don't bother with complex write buffering.  the buffer is a simple string which will
+   *       be empty except for keepalives after the initial connection negotiation. */
+  wbuffer_.assign(msg_connect);
+  for (auto& filter : filters_)
+    wbuffer_.append(filter);
+}
+
+auto client::close_socket() -> void
+{
+  if (socket_ != -1)
+  {
+    close(socket_);
+    add_stat(stats_.disconnects, 1);
+  }
+  socket_ = -1;
+  last_keepalive_ = 0;
+  wbuffer_.clear();
+}
+
+auto client::drop() -> void
+{
+  close_socket();
+
+  if (reconnect_max_ == 0 || address_.empty())
+  {
+    state_ = rapic::connection_state::disconnected;
+    return;
+  }
+
+  // schedule our next attempt
+  state_ = rapic::connection_state::waiting;
+  reconnect_at_ = time(NULL) + reconnect_delay_;
+  reconnect_delay_ = std::min(reconnect_delay_ * 2, reconnect_max_);
+
+  // any partial message at the end of the buffer will never be completed, so have the reader discard it
+  discard_at_ = wcount_.load();
+  discard_pending_ = true;
+}
+
+auto client::check_cur_type(message_type type) -> void
+{
+  if (cur_type_ != type)
+  {
+    if (cur_type_ == no_message)
+      throw std::runtime_error{"rapic: no message dequeued for decoding"};
     else
       throw std::runtime_error{"rapic: incorrect type passed for decoding"};
   }
 }
 
-auto client::buffer_starts_with(std::string const& str) const -> bool
+auto client::buffer_grow() -> bool
+{
+  // this function is only ever called from the read thread while the buffer is full
+  size_t cap = capacity_;
+  if (cap >= max_capacity_)
+    return false;
+
+  // double the capacity (max_capacity_ is page aligned so the result is too)
+  auto new_cap = std::min(cap * 2, max_capacity_);
+  auto grown = buffer{map_ring_buffer(new_cap, spill_dir_), buffer_deleter{new_cap}};
+
+  // keep the counts unchanged and move the unread data to the equivalent position in the new buffer
+  std::lock_guard<std::mutex> lock{buffer_mutex_};
+  auto rc = rcount_.load();
+  memcpy(&grown[rc % new_cap], &buffer_[rc % cap], wcount_ - rc);
+  buffer_ = std::move(grown);
+  capacity_ = new_cap;
+
+  add_stat(stats_.buffer_grows, 1);
+  return true;
+}
+
+auto client::buffer_starts_with(std::string const& str, size_t wc) const -> bool
 {
   // cache rcount_ to reduce performance drop of atomic reads
   // this function is only ever called from the read thread
   auto rc = rcount_.load();
 
   // is there even enough data in the buffer?
-  auto size = wcount_ - rc;
+  auto size = wc - rc;
   if (size < str.size())
     return false;
 
-  // check each character for a match
-  for (size_t i = 0; i < str.size(); ++i)
-    if (str[i] != buffer_[(rc + i) % capacity_])
-      return false;
-
-  return true;
+  return memcmp(&buffer_[rc % capacity_], str.data(), str.size()) == 0;
 }
 
-auto client::buffer_find(std::string const& str, size_t& pos) const -> bool
+auto client::buffer_find(std::string const& str, size_t wc, size_t& pos) -> bool
 {
   // cache rcount_ to reduce performance drop of atomic reads
   // this function is only ever called from the read thread
   auto rc = rcount_.load();
 
+  // if we are looking for a different terminator than last time then restart the search
+  if (search_term_ != &str)
+  {
+    search_term_ = &str;
+    search_pos_ = 0;
+  }
+
   // is there even enough data in the buffer?
-  auto size = wcount_ - rc;
+  auto size = wc - rc;
   if (size < str.size())
     return false;
 
-  // naive search through the buffer
-  for (size_t i = 0; i < size - str.size(); ++i)
+  // the buffer is mirrored so the unread data is contiguous from the read position
+  auto data = &buffer_[rc % capacity_];
+  auto last = size - str.size();
+  auto i = search_pos_;
+  while (i <= last)
+  {
+    auto hit = static_cast<uint8_t const*>(memchr(&data[i], str[0], last - i + 1));
+    if (!hit)
+    {
+      i = last + 1;
+      break;
+    }
+    i = hit - data;
+    if (memcmp(hit + 1, str.data() + 1, str.size() - 1) == 0)
+    {
+      pos = i;
+      return true;
+    }
+    ++i;
+  }
+
+  // remember where we got to so that the next call only examines newly arrived data
+  search_pos_ = i;
+  return false;
+}
+
+client_pool::client_pool()
+  : epoll_fd_{epoll_create1(EPOLL_CLOEXEC)}
+  , cursor_{entries_.end()}
+  , last_sweep_{0}
+{
+  if (epoll_fd_ == -1)
+    throw std::system_error{errno, std::system_category(), "rapic: epoll creation failed"};
+}
+
+client_pool::~client_pool()
+{
+  close(epoll_fd_);
+}
+
+auto client_pool::add(client con) -> client&
+{
+  entries_.emplace_back(std::move(con));
+  return entries_.back().con;
+}
+
+auto client_pool::remove(client const& con) -> void
+{
+  for (auto i = entries_.begin(); i != entries_.end(); ++i)
   {
-    for (size_t j = 0; j < str.size(); ++j)
-      if (str[j] != buffer_[(rc + i + j) % capacity_])
-        goto next_i;
-    pos = i;
+    if (&i->con == &con)
+    {
+      forget_registration(*i);
+      if (cursor_ == i)
+        ++cursor_;
+      entries_.erase(i);
+      return;
+    }
+  }
+  throw std::invalid_argument{"rapic: client is not a member of pool"};
+}
+
+auto client_pool::size() const -> size_t
+{
+  return entries_.size();
+}
+
+auto client_pool::pollable_fd() const -> int
+{
+  return epoll_fd_;
+}
+
+auto client_pool::poll(int timeout) -> void
+{
+  // drop stale registrations first, since a closed descriptor may have been reused by another connection
+  for (auto& e : entries_)
+    if (e.con.pollable_fd() != e.fd)
+      forget_registration(e);
+
+  // bring our epoll registrations up to date with the state of each connection
+  bool pending = false;
+  for (auto& e : entries_)
+  {
+    update_registration(e);
+    pending = pending || e.ready;
+  }
+
+  // if there is already work outstanding then don't block
+  if (pending)
+    timeout = 0;
+
+  // clients waiting to reconnect have no descriptor and a stalled connection attempt never becomes ready, so make
+  // sure we wake up in time to sweep them
+  for (auto& e : entries_)
+  {
+    auto state = e.con.connection_state();
+    if (   (state == rapic::connection_state::waiting || state == rapic::connection_state::in_progress)
+        && (timeout < 0 || timeout > 1000))
+      timeout = 1000;
+  }
+
+  epoll_event events[64];
+  int count;
+  while ((count = epoll_wait(epoll_fd_, events, 64, timeout)) == -1)
+  {
+    if (errno != EINTR)
+      throw std::system_error{errno, std::system_category(), "rapic: epoll_wait failure"};
+  }
+
+  for (int i = 0; i < count; ++i)
+    static_cast<entry*>(events[i].data.ptr)->ready = true;
+}
+
+auto client_pool::process_traffic(error_fn on_error) -> bool
+{
+  // clients must be serviced periodically even when idle so that keepalives and timeouts are handled
+  auto now = time(NULL);
+  auto sweep = now != last_sweep_;
+  if (sweep)
+    last_sweep_ = now;
+
+  bool again = false;
+  for (auto& e : entries_)
+  {
+    if (!e.ready && !sweep)
+      continue;
+
+    try
+    {
+      e.ready = e.con.process_traffic();
+      again = again || e.ready;
+    }
+    catch (std::exception& err)
+    {
+      // the client has already disconnected itself
+      e.ready = false;
+      forget_registration(e);
+      if (!on_error)
+        throw;
+      on_error(e.con, err);
+    }
+
+    // if the connection was dropped (or failed over to another address) the descriptor may be reused before our
+    // next update
+    if (e.con.pollable_fd() != e.fd)
+      forget_registration(e);
+  }
+  return again;
+}
+
+auto client_pool::dequeue(client*& con, message_type& type) -> bool
+{
+  for (size_t i = 0; i < entries_.size(); ++i)
+  {
+    if (cursor_ == entries_.end())
+      cursor_ = entries_.begin();
+    auto cur = cursor_++;
+    if (cur->con.dequeue(type))
+    {
+      con = &cur->con;
+      return true;
+    }
+  }
+  return false;
+}
+
+auto client_pool::update_registration(entry& e) -> void
+{
+  auto fd = e.con.pollable_fd();
+  uint32_t events = 0;
+  if (e.con.poll_read())
+    events |= EPOLLIN | EPOLLRDHUP;
+  if (e.con.poll_write())
+    events |= EPOLLOUT;
+
+  if (fd == -1 || (fd == e.fd && events == e.events))
+    return;
+
+  epoll_event ev;
+  ev.events = events;
+  ev.data.ptr = &e;
+
+  // closing a socket silently removes it from epoll, so be prepared for the kernel to disagree with us
+  auto op = e.fd == -1 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+  if (epoll_ctl(epoll_fd_, op, fd, &ev) == -1)
+  {
+    if (op == EPOLL_CTL_ADD && errno == EEXIST)
+      op = EPOLL_CTL_MOD;
+    else if (op == EPOLL_CTL_MOD && errno == ENOENT)
+      op = EPOLL_CTL_ADD;
+    else
+      throw std::system_error{errno, std::system_category(), "rapic: epoll_ctl failure"};
+    if (epoll_ctl(epoll_fd_, op, fd, &ev) == -1)
+      throw std::system_error{errno, std::system_category(), "rapic: epoll_ctl failure"};
+  }
+
+  e.fd = fd;
+  e.events = events;
+}
+
+auto client_pool::forget_registration(entry& e) -> void
+{
+  // the descriptor may have already been closed (and removed automatically) so ignore errors here
+  if (e.fd != -1)
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, e.fd, nullptr);
+  e.fd = -1;
+  e.events = 0;
+}
+
+// shared separator queued after published scans which lack a trailing newline
+static const server::message_ptr msg_separator = std::make_shared<std::vector<uint8_t> const>(1, '\n');
+
+server::server(size_t max_queued, time_t inactivity_timeout)
+  : max_queued_{max_queued}
+  , inactivity_timeout_{inactivity_timeout}
+  , epoll_fd_{epoll_create1(EPOLL_CLOEXEC)}
+  , listen_fd_{-1}
+  , listen_ready_{false}
+  , last_sweep_{0}
+{
+  if (epoll_fd_ == -1)
+    throw std::system_error{errno, std::system_category(), "rapic: epoll creation failed"};
+}
+
+server::~server()
+{
+  shutdown();
+  close(epoll_fd_);
+}
+
+auto server::listen(std::string const& address, std::string const& service) -> void
+{
+  if (listen_fd_ != -1)
+    throw std::runtime_error{"rapic: listen called while already listening"};
+
+  // lookup the local address
+  addrinfo hints, *addr;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_flags = AI_PASSIVE;
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  int ret = getaddrinfo(address.empty() ? nullptr : address.c_str(), service.c_str(), &hints, &addr);
+  if (ret != 0 || addr == nullptr)
+    throw std::runtime_error{"rapic: unable to resolve listen address"};
+
+  // listen on the first address that we are able to bind
+  int err = 0;
+  for (auto a = addr; a; a = a->ai_next)
+  {
+    listen_fd_ = socket(a->ai_family, a->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, a->ai_protocol);
+    if (listen_fd_ == -1)
+    {
+      err = errno;
+      continue;
+    }
+
+    int on = 1;
+    setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (bind(listen_fd_, a->ai_addr, a->ai_addrlen) == 0 && ::listen(listen_fd_, SOMAXCONN) == 0)
+      break;
+
+    err = errno;
+    close(listen_fd_);
+    listen_fd_ = -1;
+  }
+  freeaddrinfo(addr);
+  if (listen_fd_ == -1)
+    throw std::system_error{err, std::system_category(), "rapic: failed to listen for connections"};
+
+  epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.ptr = nullptr;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &ev) == -1)
+  {
+    err = errno;
+    close(listen_fd_);
+    listen_fd_ = -1;
+    throw std::system_error{err, std::system_category(), "rapic: epoll_ctl failure"};
+  }
+  listen_ready_ = true;
+}
+
+auto server::shutdown() -> void
+{
+  while (!connections_.empty())
+    drop(connections_.begin());
+  if (listen_fd_ != -1)
+    close(listen_fd_);
+  listen_fd_ = -1;
+  listen_ready_ = false;
+}
+
+auto server::port() const -> int
+{
+  if (listen_fd_ == -1)
+    return -1;
+
+  sockaddr_storage addr;
+  socklen_t len = sizeof(addr);
+  if (getsockname(listen_fd_, reinterpret_cast<sockaddr*>(&addr), &len) == -1)
+    throw std::system_error{errno, std::system_category(), "rapic: getsockname failure"};
+  if (addr.ss_family == AF_INET)
+    return ntohs(reinterpret_cast<sockaddr_in*>(&addr)->sin_port);
+  if (addr.ss_family == AF_INET6)
+    return ntohs(reinterpret_cast<sockaddr_in6*>(&addr)->sin6_port);
+  return -1;
+}
+
+auto server::connections() const -> size_t
+{
+  return std::count_if(connections_.begin(), connections_.end(), [](connection const& con) { return con.active; });
+}
+
+auto server::queued() const -> size_t
+{
+  size_t total = 0;
+  for (auto& con : connections_)
+    total += con.wsize;
+  return total;
+}
+
+auto server::poll(int timeout) -> void
+{
+  // if there is already work outstanding then don't block
+  if (listen_ready_)
+    timeout = 0;
+  for (auto& con : connections_)
+    if (con.ready)
+      timeout = 0;
+
+  epoll_event events[64];
+  int count;
+  while ((count = epoll_wait(epoll_fd_, events, 64, timeout)) == -1)
+  {
+    if (errno != EINTR)
+      throw std::system_error{errno, std::system_category(), "rapic: epoll_wait failure"};
+  }
+
+  for (int i = 0; i < count; ++i)
+  {
+    if (events[i].data.ptr)
+      static_cast<connection*>(events[i].data.ptr)->ready = true;
+    else
+      listen_ready_ = true;
+  }
+}
+
+auto server::process_traffic() -> bool
+{
+  // connections must be checked periodically even when idle so that timeouts are handled
+  auto now = time(NULL);
+  auto sweep = now != last_sweep_;
+  if (sweep)
+    last_sweep_ = now;
+
+  if (listen_ready_)
+    accept_connections();
+
+  bool again = listen_ready_;
+  for (auto i = connections_.begin(); i != connections_.end(); )
+  {
+    if (!i->ready && !sweep)
+    {
+      ++i;
+      continue;
+    }
+
+    try
+    {
+      i->ready = read_requests(*i, now);
+      write_messages(*i);
+      if (now - i->last_activity > inactivity_timeout_)
+        throw std::runtime_error{"rapic: inactivity timeout"};
+      update_registration(*i);
+      again = again || i->ready;
+      ++i;
+    }
+    catch (std::exception&)
+    {
+      // a failure on one connection must not affect the others
+      i = drop(i);
+    }
+  }
+  return again;
+}
+
+auto server::publish(scan const& msg, ray_encoding encoding) -> void
+{
+  // avoid encoding the scan if nobody will receive it
+  auto interested = std::any_of(connections_.begin(), connections_.end(), [&](connection const& con)
+  {
+    return con.active && matches(con, msg);
+  });
+  if (!interested)
+    return;
+
+  auto raw = std::make_shared<std::vector<uint8_t>>();
+  msg.encode(*raw, encoding);
+  publish(msg, std::move(raw));
+}
+
+auto server::publish(scan const& msg, message_ptr raw) -> void
+{
+  auto separate = !raw->empty() && raw->back() != '\n';
+  for (auto i = connections_.begin(); i != connections_.end(); )
+  {
+    if (i->active && matches(*i, msg) && (!enqueue(*i, raw) || (separate && !enqueue(*i, msg_separator))))
+      i = drop(i);
+    else
+      ++i;
+  }
+}
+
+auto server::publish(mssg const& msg) -> void
+{
+  auto raw = std::make_shared<std::vector<uint8_t> const>(msg.content.begin(), msg.content.end());
+  for (auto i = connections_.begin(); i != connections_.end(); )
+  {
+    if (i->active && !enqueue(*i, raw))
+      i = drop(i);
+    else
+      ++i;
+  }
+}
+
+auto server::accept_connections() -> void
+{
+  while (true)
+  {
+    auto fd = accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd == -1)
+    {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      listen_ready_ = false;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return;
+      throw std::system_error{errno, std::system_category(), "rapic: accept failure"};
+    }
+
+    connections_.emplace_back();
+    auto& con = connections_.back();
+    con.fd = fd;
+    con.events = 0;
+    con.ready = false;
+    con.active = false;
+    con.woffset = 0;
+    con.wsize = 0;
+    con.last_activity = time(NULL);
+    try
+    {
+      update_registration(con);
+    }
+    catch (...)
+    {
+      drop(std::prev(connections_.end()));
+      throw;
+    }
+  }
+}
+
+auto server::read_requests(connection& con, time_t now) -> bool
+{
+  char buf[4096];
+  ssize_t bytes;
+  while ((bytes = recv(con.fd, buf, sizeof(buf), 0)) == -1)
+  {
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+      return false;
+    if (errno != EINTR)
+      throw std::system_error{errno, std::system_category(), "rapic: recv failure"};
+  }
+  if (bytes == 0)
+    throw std::runtime_error{"rapic: connection closed by client"};
+
+  con.last_activity = now;
+  con.rbuffer.append(buf, bytes);
+
+  // handle each complete request line
+  size_t pos = 0, end;
+  while ((end = con.rbuffer.find('\n', pos)) != std::string::npos)
+  {
+    auto len = end - pos;
+    if (len > 0 && con.rbuffer[end - 1] == '\r')
+      --len;
+    handle_request(con, con.rbuffer.substr(pos, len));
+    pos = end + 1;
+  }
+  con.rbuffer.erase(0, pos);
+  if (con.rbuffer.size() > sizeof(buf))
+    throw std::runtime_error{"rapic: request line too long"};
+
+  // if we filled our buffer there may be more still waiting
+  return static_cast<size_t>(bytes) == sizeof(buf);
+}
+
+auto server::handle_request(connection& con, std::string const& line) -> void
+{
+  // RPQUERY enables the stream of new messages
+  if (line.compare(0, msg_query_head.size(), msg_query_head) == 0)
+  {
+    con.active = true;
+    return;
+  }
+
+  // RPFILTER:station:product:video format:data source[:moments]
+  /* see client::add_filter for the meaning of each field.  malformed filters are silently ignored since there
+   * is no way to report them back to the client. */
+  if (line.compare(0, msg_filter_head.size(), msg_filter_head) == 0)
+  {
+    std::vector<std::string> fields;
+    size_t pos = msg_filter_head.size(), end;
+    do
+    {
+      end = line.find(':', pos);
+      fields.emplace_back(line, pos, end == std::string::npos ? std::string::npos : end - pos);
+      pos = end + 1;
+    } while (end != std::string::npos);
+    if (fields.size() < 2)
+      return;
+
+    filter f;
+    char* end_station;
+    f.station = strtol(fields[0].c_str(), &end_station, 10);
+    if (fields[0].empty() || *end_station != '\0')
+      return;
+    f.product = std::move(fields[1]);
+    if (fields.size() > 4)
+    {
+      size_t pos = 0, end;
+      do
+      {
+        end = fields[4].find(',', pos);
+        f.moments.emplace_back(fields[4], pos, end == std::string::npos ? std::string::npos : end - pos);
+        pos = end + 1;
+      } while (end != std::string::npos);
+    }
+    con.filters.push_back(std::move(f));
+    return;
+  }
+
+  // anything else (such as an RDRSTAT keepalive) only serves to reset the inactivity timeout
+}
+
+auto server::write_messages(connection& con) -> void
+{
+  // gather as many queued messages as possible into each send
+  while (!con.wqueue.empty())
+  {
+    iovec iov[64];
+    size_t count = 0;
+    for (auto i = con.wqueue.begin(); i != con.wqueue.end() && count < 64; ++i, ++count)
+    {
+      iov[count].iov_base = const_cast<uint8_t*>((*i)->data());
+      iov[count].iov_len = (*i)->size();
+    }
+    iov[0].iov_base = static_cast<uint8_t*>(iov[0].iov_base) + con.woffset;
+    iov[0].iov_len -= con.woffset;
+
+    msghdr hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_iov = iov;
+    hdr.msg_iovlen = count;
+
+    auto bytes = sendmsg(con.fd, &hdr, MSG_NOSIGNAL);
+    if (bytes == -1)
+    {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return;
+      if (errno == EINTR)
+        continue;
+      throw std::system_error{errno, std::system_category(), "rapic: send failure"};
+    }
+
+    // release the messages which have been completely written
+    con.wsize -= bytes;
+    bytes += con.woffset;
+    while (!con.wqueue.empty() && static_cast<size_t>(bytes) >= con.wqueue.front()->size())
+    {
+      bytes -= con.wqueue.front()->size();
+      con.wqueue.pop_front();
+    }
+    con.woffset = bytes;
+
+    // a partial write means the socket buffer is full
+    if (!con.wqueue.empty() && count < 64)
+      return;
+  }
+}
+
+auto server::enqueue(connection& con, message_ptr const& msg) -> bool
+{
+  if (con.wsize + msg->size() > max_queued_)
+    return false;
+  con.wqueue.push_back(msg);
+  con.wsize += msg->size();
+  con.ready = true;
+  return true;
+}
+
+auto server::update_registration(connection& con) -> void
+{
+  uint32_t events = EPOLLIN | EPOLLRDHUP;
+  if (!con.wqueue.empty())
+    events |= EPOLLOUT;
+  if (events == con.events)
+    return;
+
+  epoll_event ev;
+  ev.events = events;
+  ev.data.ptr = &con;
+  if (epoll_ctl(epoll_fd_, con.events == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, con.fd, &ev) == -1)
+    throw std::system_error{errno, std::system_category(), "rapic: epoll_ctl failure"};
+  con.events = events;
+}
+
+auto server::drop(connection_store::iterator i) -> connection_store::iterator
+{
+  // closing the socket also removes it from epoll
+  close(i->fd);
+  return connections_.erase(i);
+}
+
+auto server::matches(connection const& con, scan const& msg) -> bool
+{
+  if (con.filters.empty())
     return true;
-next_i:
-    ;
+
+  for (auto& f : con.filters)
+  {
+    if (f.station != -1 && f.station != msg.station_id())
+      continue;
+
+    // volumes are identified by the product header, other types by the image format
+    if (strcasecmp(f.product.c_str(), "ANY") != 0)
+    {
+      if (   strcasecmp(f.product.c_str(), "VOL") == 0
+          || strcasecmp(f.product.c_str(), "VOLUME") == 0)
+      {
+        if (msg.product().compare(0, 10, "VOLUMETRIC") != 0)
+          continue;
+      }
+      else
+      {
+        auto fmt = msg.find_header(header_id::imgfmt);
+        if (!fmt || strcasecmp(fmt->value().c_str(), f.product.c_str()) != 0)
+          continue;
+      }
+    }
+
+    if (!f.moments.empty())
+    {
+      auto video = msg.find_header(header_id::video);
+      if (!video || std::none_of(f.moments.begin(), f.moments.end(), [&](std::string const& m)
+          {
+            return strcasecmp(m.c_str(), video->value().c_str()) == 0;
+          }))
+        continue;
+    }
+
+    return true;
+  }
+  return false;
+}
+
+decode_pool::decode_pool(size_t threads)
+  : next_{0}
+  , stop_{false}
+{
+  if (threads == 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+
+  try
+  {
+    threads_.reserve(threads);
+    for (size_t i = 0; i < threads; ++i)
+      threads_.emplace_back(&decode_pool::worker, this);
+  }
+  catch (...)
+  {
+    {
+      std::lock_guard<std::mutex> lock{mutex_};
+      stop_ = true;
+    }
+    work_cv_.notify_all();
+    for (auto& t : threads_)
+      t.join();
+    throw;
+  }
+}
+
+decode_pool::~decode_pool()
+{
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    stop_ = true;
+  }
+  work_cv_.notify_all();
+  for (auto& t : threads_)
+    t.join();
+}
+
+auto decode_pool::enqueue(client& con) -> void
+{
+  con.check_cur_type(message_type::scan);
+
+  auto j = acquire();
+  con.decode_raw(j->raw);
+  submit(std::move(j));
+}
+
+auto decode_pool::enqueue(uint8_t const* in, size_t size) -> void
+{
+  auto j = acquire();
+  j->raw.assign(in, in + size);
+  submit(std::move(j));
+}
+
+auto decode_pool::dequeue(scan& msg, bool wait) -> bool
+{
+  std::unique_lock<std::mutex> lock{mutex_};
+  if (jobs_.empty())
+    return false;
+  if (!jobs_.front()->done)
+  {
+    if (!wait)
+      return false;
+    done_cv_.wait(lock, [&]{ return jobs_.front()->done; });
+  }
+
+  // swap rather than move so that the callers old scan is recycled by a future decode
+  auto j = std::move(jobs_.front());
+  jobs_.pop_front();
+  --next_;
+  std::swap(msg, j->msg);
+  auto err = j->err;
+  j->err = nullptr;
+  spare_.push_back(std::move(j));
+
+  if (err)
+    std::rethrow_exception(err);
+  return true;
+}
+
+auto decode_pool::pending() const -> size_t
+{
+  std::lock_guard<std::mutex> lock{mutex_};
+  return jobs_.size();
+}
+
+auto decode_pool::acquire() -> job_ptr
+{
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    if (!spare_.empty())
+    {
+      auto j = std::move(spare_.back());
+      spare_.pop_back();
+      return j;
+    }
+  }
+  return job_ptr{new job()};
+}
+
+auto decode_pool::submit(job_ptr j) -> void
+{
+  j->done = false;
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    jobs_.push_back(std::move(j));
+  }
+  work_cv_.notify_one();
+}
+
+auto decode_pool::worker() -> void
+{
+  std::unique_lock<std::mutex> lock{mutex_};
+  while (true)
+  {
+    work_cv_.wait(lock, [&]{ return stop_ || next_ < jobs_.size(); });
+    if (stop_)
+      return;
+
+    // jobs are only removed from the front once done, so this pointer remains valid while we work
+    auto j = jobs_[next_++].get();
+    lock.unlock();
+
+    try
+    {
+      j->msg.decode(j->raw.data(), j->raw.size());
+    }
+    catch (...)
+    {
+      j->err = std::current_exception();
+    }
+
+    lock.lock();
+    j->done = true;
+    done_cv_.notify_all();
+  }
+}
+
+file_reader::file_reader(std::string const& path)
+  : data_{nullptr}
+  , size_{0}
+  , pos_{0}
+{
+  auto fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    throw std::system_error{errno, std::system_category(), "rapic: failed to open " + path};
+
+  struct stat st;
+  if (fstat(fd, &st) == -1)
+  {
+    auto err = errno;
+    close(fd);
+    throw std::system_error{err, std::system_category(), "rapic: failed to read " + path};
+  }
+  size_ = st.st_size;
+
+  // an empty file cannot be mapped, but there is nothing to read anyway
+  if (size_ > 0)
+  {
+    auto ptr = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (ptr == MAP_FAILED)
+    {
+      auto err = errno;
+      close(fd);
+      throw std::system_error{err, std::system_category(), "rapic: failed to map " + path};
+    }
+    data_ = static_cast<uint8_t*>(ptr);
+
+    // this is only a hint so failure is harmless
+    madvise(data_, size_, MADV_SEQUENTIAL);
   }
 
-  // we return 0 to indicate failure - it's easy but
+  // the mapping keeps the file alive
+  close(fd);
+}
+
+file_reader::~file_reader()
+{
+  if (data_)
+    munmap(data_, size_);
+}
+
+auto file_reader::next(uint8_t const*& data, size_t& size) -> bool
+{
+  while (pos_ < size_)
+  {
+    // whitespace - skip
+    if (data_[pos_] <= ' ')
+    {
+      ++pos_;
+      continue;
+    }
+
+    // image header - skip
+    if (data_[pos_] == '/')
+    {
+      auto eol = static_cast<uint8_t const*>(memchr(&data_[pos_], '\n', size_ - pos_));
+      pos_ = eol ? eol - data_ : size_;
+      continue;
+    }
+
+    // scan - find the end
+    auto end = find_scan_end(data_, size_, pos_);
+    if (end == 0)
+      throw std::runtime_error{"rapic: unterminated scan at end of file"};
+
+    data = &data_[pos_];
+    size = end - pos_;
+    pos_ = end;
+    return true;
+  }
   return false;
 }
+
+auto file_reader::read(scan& msg, decode_mode mode) -> bool
+{
+  uint8_t const* data;
+  size_t size;
+  if (!next(data, size))
+    return false;
+  msg.decode(data, size, mode);
+  return true;
+}
+
+volume_assembler::volume_assembler(time_t timeout)
+  : timeout_{timeout}
+{ }
+
+auto volume_assembler::add(scan msg) -> void
+{
+  auto now = time(NULL);
+
+  // scans without valid pass information cannot be grouped
+  if (msg.pass() < 1 || msg.pass() > msg.pass_count())
+  {
+    ready_.emplace_back();
+    ready_.back().push_back(std::move(msg));
+    return;
+  }
+
+  // find the volume this scan belongs to, or start a new one
+  auto vol = partials_.begin();
+  for (; vol != partials_.end(); ++vol)
+  {
+    auto& first = vol->scans.front();
+    if (   first.station_id() == msg.station_id()
+        && first.volume_id() == msg.volume_id()
+        && first.pass_count() == msg.pass_count()
+        && first.product() == msg.product())
+      break;
+  }
+  if (vol == partials_.end())
+    vol = partials_.emplace(partials_.end());
+  vol->last_update = now;
+
+  // insert the scan in pass order, replacing a repeated pass
+  auto pos = vol->scans.begin();
+  while (pos != vol->scans.end() && pos->pass() < msg.pass())
+    ++pos;
+  if (pos != vol->scans.end() && pos->pass() == msg.pass())
+    *pos = std::move(msg);
+  else
+    vol->scans.insert(pos, std::move(msg));
+
+  // is the volume complete?
+  if (static_cast<int>(vol->scans.size()) == vol->scans.front().pass_count())
+  {
+    ready_.push_back(std::move(vol->scans));
+    partials_.erase(vol);
+  }
+}
+
+auto volume_assembler::dequeue(std::list<scan>& volume) -> bool
+{
+  expire(time(NULL));
+
+  if (ready_.empty())
+    return false;
+
+  volume = std::move(ready_.front());
+  ready_.pop_front();
+  return true;
+}
+
+auto volume_assembler::flush() -> void
+{
+  for (auto& vol : partials_)
+    ready_.push_back(std::move(vol.scans));
+  partials_.clear();
+}
+
+auto volume_assembler::expire(time_t now) -> void
+{
+  for (auto vol = partials_.begin(); vol != partials_.end(); )
+  {
+    if (now - vol->last_update >= timeout_)
+    {
+      ready_.push_back(std::move(vol->scans));
+      vol = partials_.erase(vol);
+    }
+    else
+      ++vol;
+  }
+}
@@ -20,11 +20,16 @@
 
 #include <atomic>
 #include <bitset>
+#include <condition_variable>
 #include <cstdint>
+#include <deque>
+#include <exception>
 #include <functional>
 #include <limits>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 #include <list>
 
@@ -46,29 +51,121 @@ namespace rapic
     std::string content;
   };
 
+  /// Identifiers for the rapic headers which are known to the library
+  /** Each identifier is the lower case version of the header name.  Identifiers are ordered alphabetically by
+   *  header name. */
+  enum class header_id
+  {
+      unknown = -1      ///< Header name not known to the library
+    , anglerate
+    , angres
+    , antdiam
+    , antgain
+    , azcorr
+    , beamwidth
+    , clearair
+    , copyright
+    , country
+    , date
+    , dbzcaldlvl
+    , dbzlvl
+    , digcaldlvl
+    , elcorr
+    , elev
+    , endrng
+    , fault
+    , frequency
+    , hbeamwidth
+    , height
+    , hiprf
+    , imgfmt
+    , latitude
+    , longitude
+    , name
+    , noisethresh
+    , nyquist
+    , pass
+    , peakpower
+    , peakpowerh
+    , peakpowerv
+    , polarisation
+    , prf
+    , product
+    , pulselength
+    , qc0
+    , qc1
+    , qc2
+    , qc3
+    , qc4
+    , qc5
+    , qc6
+    , qc7
+    , radartype
+    , rngres
+    , rxgain_h
+    , rxgain_v
+    , rxnoise_h
+    , rxnoise_v
+    , startrng
+    , stcrange
+    , stnid
+    , stn_num
+    , tilt
+    , time
+    , timestamp
+    , txfrequency
+    , txpeakpwr
+    , unfolding
+    , vbeamwidth
+    , vellvl
+    , vers
+    , video
+    , videogain
+    , videooffset
+    , videounits
+    , vidres
+    , volumeid
+    , wmonumber
+    , count             ///< Number of known headers (not a valid identifier)
+  };
+
+  /// Get the identifier for a header name
+  /** Returns header_id::unknown if the header name is not known to the library. */
+  auto lookup_header_id(char const* name, size_t len) -> header_id;
+  inline auto lookup_header_id(std::string const& name) -> header_id { return lookup_header_id(name.c_str(), name.size()); }
+
+  /// Get the name of a known header
+  auto header_name(header_id id) -> std::string const&;
+
   /// Header used by a scan message
   class header
   {
   public:
-    header(std::string name, std::string value)
-      : name_(std::move(name)), value_(std::move(value))
-    { }
+    header(std::string name, std::string value);
+    header(header_id id, std::string value);
+
+    /// Get the identifier of the header
+    /** Returns header_id::unknown if the header name is not known to the library. */
+    auto id() const -> header_id                      { return id_; }
 
     /// Get the name of the header
-    auto name() const -> std::string const&           { return name_; }
+    auto name() const -> std::string const&           { return id_ == header_id::unknown ? name_ : header_name(id_); }
     /// Set the name of the header
-    auto set_name(std::string const& name) -> void    { name_ = name; }
+    auto set_name(std::string const& name) -> void;
 
     /// Get the header value
     auto value() const -> std::string const&          { return value_; }
-    /// Get the header value
-    auto set_value(std::string const& value) -> void  { value_ = value; }
+    /// Set the header value
+    auto set_value(std::string const& value) -> void;
 
     /// Get the header value as a bool
     auto get_boolean() const -> bool;
     /// Get the header value as a long
     auto get_integer() const -> long;
     /// Get the header value as a double
+    /** Numeric values are parsed independently of the current locale.  The values of known numeric headers are
+     *  parsed once when the header value is set, so repeated calls to get_real() and get_real_array() for these
+     *  headers do not reparse the value. */
     auto get_real() const -> double;
     /// Get the header value as a vector of longs
     auto get_integer_array() const -> std::vector<long>;
@@ -76,8 +173,17 @@ namespace rapic
     auto get_real_array() const -> std::vector<double>;
 
   private:
-    std::string name_;
-    std::string value_;
+    auto assign_name(char const* name, size_t len) -> void;
+    auto parse_value() -> void;
+
+  private:
+    header_id           id_;
+    std::string         name_;    // only used for unknown headers
+    std::string         value_;
+    std::vector<double> reals_;   // parsed value of known numeric headers
+    bool                parsed_;  // whether reals_ holds the parsed value
+
+    friend class scan;
   };
 
   /// Information about a single ray
@@ -113,7 +219,26 @@ namespace rapic
     int   time_offset_;
   };
 
+  /// Modes of decoding scan messages
+  enum class decode_mode
+  {
+      full          ///< Decode the headers and ray data immediately
+    , headers_only  ///< Decode the headers only and discard the ray data
+    , lazy          ///< Decode the headers immediately and the ray data when it is first accessed
+  };
+
+  /// Ray encodings used when encoding scans
+  enum class ray_encoding
+  {
+      ascii         ///< ASCII absolute, run length and delta encoding ('%' rays)
+    , binary        ///< Binary run length encoding ('@' rays)
+    , compact       ///< Whichever of the ASCII or binary encodings produces the smaller message
+  };
+
   /// Radar product message
+  /** Decoding into an existing scan object reuses the storage allocated by previous decodes.  Applications which
+   *  handle a high rate of scans should prefer to keep and reuse scan objects rather than creating a new one for
+   *  each message. */
   class scan
   {
   public:
@@ -124,8 +249,27 @@ namespace rapic
     auto reset() -> void;
 
     /// Decode a scan from the raw wire format
-    /** Returns number of bytes consumed from in buffer */
-    auto decode(uint8_t const* in, size_t size) -> size_t;
+    /** Returns number of bytes consumed from in buffer.
+     *
+     *  In headers_only mode the ray data is skipped without being decoded.  The header derived values including
+     *  rays() and bins() are available as normal, however ray_headers() will be empty and level_data() must not
+     *  be accessed.
+     *
+     *  In lazy mode a copy of the encoded ray data is retained and decoded upon the first call to ray_headers()
+     *  or level_data().  Errors in the ray data are reported by an exception from that first call rather than
+     *  from decode().  Since the first access modifies the scan it must not be made concurrently from multiple
+     *  threads. */
+    auto decode(uint8_t const* in, size_t size, decode_mode mode = decode_mode::full) -> size_t;
+
+    /// Encode the scan into the raw wire format
+    /** The encoded message is appended to out.  Every header is written in its original order followed by the
+     *  rays and the end of scan marker.  Trailing zero levels at the end of each ray are omitted.
+     *
+     *  The ASCII encoding is only able to represent whole degree ray angles (tenths of a degree for RHIs) and
+     *  levels up to 159.  Requesting the ASCII encoding of a scan which does not meet these limits will throw,
+     *  while the compact option will silently use the binary encoding instead.  A scan which was decoded in
+     *  headers_only mode has no ray data and cannot be encoded. */
+    auto encode(std::vector<uint8_t>& out, ray_encoding encoding = ray_encoding::compact) const -> void;
 
     /// Get the station identifier
     auto station_id() const -> int                                    { return station_id_; }
@@ -167,12 +311,20 @@ namespace rapic
     auto headers() const -> std::vector<header> const&                { return headers_; }
 
     /// Find a specific header
-    /** Returns nullptr if the header is not present. */
-    auto find_header(std::string const& name) const -> header const*  { return find_header(name.c_str()); }
+    /** Returns nullptr if the header is not present.  Searching by identifier is a constant time operation and
+     *  should be preferred for known headers. */
+    auto find_header(header_id id) const -> header const*
+    {
+      return id == header_id::unknown || header_index_[static_cast<int>(id)] == -1
+        ? nullptr
+        : &headers_[header_index_[static_cast<int>(id)]];
+    }
+    auto find_header(std::string const& name) const -> header const*  { return find_header(name.c_str(), name.size()); }
     auto find_header(char const* name) const -> header const*;
+    auto find_header(char const* name, size_t len) const -> header const*;
 
     /// Access the information about each ray
-    auto ray_headers() const -> std::vector<ray_header> const&        { return ray_headers_; }
+    auto ray_headers() const -> std::vector<ray_header> const&        { if (deferred_) decode_deferred(); return ray_headers_; }
 
     /// Get the number of rays (ie: rows) in the level data array
     auto rays() const -> int                                          { return rays_; }
@@ -181,20 +333,31 @@ namespace rapic
     auto bins() const -> int                                          { return bins_; }
 
     /// Access the scan data encoded as levels
-    auto level_data() const -> uint8_t const*                         { return level_data_.data(); }
+    auto level_data() const -> uint8_t const*                         { if (deferred_) decode_deferred(); return level_data_.data(); }
 
   private:
-    auto get_header_string(char const* name) const -> std::string const&;
-    auto get_header_integer(char const* name) const -> long;
-    auto get_header_real(char const* name) const -> double;
+    auto get_header_string(header_id id) const -> std::string const&;
+    auto get_header_integer(header_id id) const -> long;
+    auto get_header_real(header_id id) const -> double;
     auto initialize_rays() -> void;
+    auto decode_rays(uint8_t const* in, size_t size, size_t pos) const -> size_t;
+    auto decode_deferred() const -> void;
+    auto encode_ascii_rays(std::vector<uint8_t>& out) const -> bool;
+    auto encode_binary_rays(std::vector<uint8_t>& out) const -> void;
+    [[noreturn]] auto rethrow_decode_error() const -> void;
 
   private:
     std::vector<header>     headers_;     // scan headers
-    std::vector<ray_header> ray_headers_; // ray headers
+    std::vector<header>     spare_;       // headers retained from previous decodes for reuse
+    int                     header_index_[static_cast<int>(header_id::count)]; // index of each known header
     int                     rays_;
     int                     bins_;
-    std::vector<uint8_t>    level_data_;  // level encoded scan data
+
+    // ray data is mutable to allow lazy decoding upon first access
+    mutable std::vector<ray_header> ray_headers_; // ray headers
+    mutable std::vector<uint8_t>    level_data_;  // level encoded scan data
+    mutable std::vector<uint8_t>    deferred_data_; // encoded ray data retained for lazy decoding
+    mutable bool                    deferred_;    // whether deferred_data_ is waiting to be decoded
 
     // these are cached from the headers structure due to likelyhood of frequent access
     int         station_id_;
@@ -214,6 +377,39 @@ namespace rapic
       disconnected    ///< Not connected
     , in_progress     ///< Socket is active but connection is still being established
     , established     ///< Connection with server is established
+    , waiting         ///< Connection was lost and will be automatically re-established after a delay
+    , resolving       ///< Server address is being looked up before connecting
+  };
+
+  /// Snapshot of the statistics collected by a client connection
+  /** Counters are cumulative over the lifetime of the client object, including across reconnections.  Times are
+   *  measured in nanoseconds using a monotonic clock.
+   *
+   *  The keepalive round trip is measured up to the point where the status reply is dequeued, so it includes any
+   *  time the reply spent waiting in the receive buffer behind unprocessed messages.  Servers which do not answer
+   *  RDRSTAT with a status message leave keepalive_replies at zero. */
+  struct client_stats
+  {
+    uint64_t  connects;             ///< Number of connection attempts (one per address tried)
+    uint64_t  disconnects;          ///< Number of times an open connection was closed (for any reason)
+    uint64_t  bytes_received;       ///< Total bytes received from the server
+    uint64_t  bytes_sent;           ///< Total bytes sent to the server
+    uint64_t  recv_calls;           ///< Number of receive system calls made
+    uint64_t  keepalives_sent;      ///< Number of RDRSTAT keepalives queued for sending
+    uint64_t  keepalive_replies;    ///< Number of keepalives answered by an MSSG 30 status message
+    uint64_t  keepalive_rtt;        ///< Time from queuing the most recent answered keepalive to dequeuing its reply
+    uint64_t  mssgs_dequeued;       ///< Number of MSSG messages dequeued
+    uint64_t  scans_dequeued;       ///< Number of scan messages dequeued
+    uint64_t  buffer_full;          ///< Number of times reading stopped because the receive buffer was full
+    uint64_t  buffer_grows;         ///< Number of times the receive buffer was grown to fit a large message
+    size_t    buffer_capacity;      ///< Current usable capacity of the receive buffer
+    size_t    buffer_used;          ///< Bytes currently held in the receive buffer
+    size_t    buffer_high_water;    ///< Largest number of bytes ever held in the receive buffer
+    uint64_t  traffic_time;         ///< Total time spent in process_traffic()
+    uint64_t  dequeue_time;         ///< Total time spent in dequeue()
+    uint64_t  decode_time;          ///< Total time spent in decode() and decode_raw()
+    uint64_t  decode_histogram[16]; ///< Scan decodes by duration (bucket n > 0 counts [2^n, 2^(n+1)) microseconds)
+    time_t    last_activity;        ///< Time that data was last received from the server
   };
 
   /// Rapic Data Server client connection manager
@@ -249,6 +445,13 @@ namespace rapic
    *      }
    *    }
    *
+   * If automatic reconnection is enabled by calling set_reconnect(), a connection that is lost or fails to be
+   * established moves to the waiting state rather than disconnected.  Errors are still thrown from process_traffic()
+   * so that they may be reported, but there is no need for the user to call connect() again.  Any partial message
+   * received before the connection was lost is discarded by dequeue().  The reconnection is made by the first call
+   * to process_traffic() once the backoff delay has expired AND dequeue() has been called until it returned false,
+   * so the user must continue to call dequeue() after a connection is lost (as in the loop shown above).
+   *
    * For asynchronous usage, the user should use the pollable_fd(), poll_read() and poll_write() functions to
    * setup the appropriate multiplexed polling function for their application.
    *
@@ -265,8 +468,14 @@ namespace rapic
    */
   class client
   {
+  public:
+    /// Function used to report connection statistics
+    using stats_fn = std::function<void(client const&, client_stats const&)>;
+
   public:
     /// Construct a new connection
+    /** The buffer size is rounded up to a whole number of system pages.  By default the buffer will never grow
+     *  beyond this size, see set_buffer_limit(). */
     client(size_t buffer_size = 10 * 1024 * 1024, time_t keepalive_period = 40, time_t inactivity_timeout = 120);
 
     client(client const&) = delete;
@@ -285,10 +494,48 @@ namespace rapic
     /** Filters added by this function will only take effect at the next call to connect(). */
     auto add_filter(int station, std::string const& product, std::vector<std::string> const& moments = {}) -> void;
 
+    /// Allow the receive buffer to grow on demand up to a maximum size
+    /** When a message is too large to fit in the buffer, dequeue() will grow the buffer by doubling its size
+     *  (limited by max_size) rather than failing with a buffer overflow.  The grown buffer is retained across
+     *  reconnections.
+     *
+     *  If spill_directory is not empty, each grown buffer is backed by an anonymous temporary file in that
+     *  directory rather than by memory.  This allows a large limit to absorb a backlog burst from the server
+     *  while the message handler catches up, without holding the whole backlog in RAM.  The directory must be
+     *  on a file system which supports O_TMPFILE.
+     *
+     *  This function must not be called at the same time as any other member function. */
+    auto set_buffer_limit(size_t max_size, std::string spill_directory = {}) -> void;
+
+    /// Request a minimum size for the socket receive buffer (SO_RCVBUF)
+    /** By default the kernel sizes the receive buffer automatically.  On Linux setting SO_RCVBUF disables this
+     *  automatic tuning and the request is capped by net.core.rmem_max, so this should only be used on hosts where
+     *  that limit has been raised.  The buffer is only set if the request is larger than the buffer the socket
+     *  already has, and failure to set it is ignored.  Pass zero to restore the default.  The request takes effect
+     *  at the next connection attempt. */
+    auto set_socket_buffer(size_t size) -> void;
+
+    /// Enable automatic reconnection when the connection is lost
+    /** The delay (in seconds) before each reconnection attempt starts at min_delay and doubles after each
+     *  consecutive failure up to max_delay.  It is reset to min_delay once data is received from the server.
+     *  Pass a max_delay of zero to disable automatic reconnection (the default).
+     *
+     *  Reconnection is deferred until dequeue() has consumed the messages received before the connection was lost,
+     *  since dequeue() is responsible for discarding any partial message that was cut off. */
+    auto set_reconnect(time_t min_delay = 1, time_t max_delay = 60) -> void;
+
     /// Connect to a server
+    /** Every address the server name resolves to is tried in turn until a connection is established, alternating
+     *  between IPv6 and IPv4 addresses.  Resolved addresses are cached and reused by reconnection attempts for up
+     *  to five minutes.
+     *
+     *  Address lookup is performed on a background thread so that this function never blocks.  While the lookup
+     *  is in progress the connection is in the resolving state and the descriptor returned by pollable_fd()
+     *  becomes readable once it completes.  Lookup failures are reported by process_traffic(). */
     auto connect(std::string address, std::string service) -> void;
 
     /// Disconnect from the server
+    /** This also cancels any pending automatic reconnection. */
     auto disconnect() -> void;
 
     /// Return the current state of the socket connection to the server
@@ -309,7 +556,8 @@ namespace rapic
 
     /// Wait (block) on the socket until some traffic arrives for processing
     /** The optional timeout parameter may be supplied to force the function to return after a cerain number
-     *  of milliseconds.  The default is 10 seconds. */
+     *  of milliseconds.  The default is 10 seconds.  While waiting to reconnect this function sleeps until the
+     *  next connection attempt is due. */
     auto poll(int timeout = 10000) const -> void;
 
     /// Process traffic on the socket (may cause new messages to be available for dequeue)
@@ -317,6 +565,9 @@ namespace rapic
      *  messages may subsequently be retrieved by calling deqeue (and decode if desired) repeatedly until
      *  dequeue returns message_type::none.
      *
+     *  Each call reads until the socket is drained, the buffer is full, or a fixed number of reads have been made
+     *  so that a single busy connection cannot starve others serviced by the same thread.
+     *
      *  If this function returns false then there is no more data currently available on the socket.  This
      *  behaviour can be used in an asynchronous I/O environment when deciding whether to continue processing
      *  traffic on this socket, or allow entry to a multiplexed wait (such as pselect). */
@@ -339,42 +590,576 @@ namespace rapic
     /** If the type of the message argument passed does not match the currently active message (as returned by the
      *  most recent call to dequeue) then a runtime exception will be thrown. */
     auto decode(mssg& msg) -> void;
-    auto decode(scan& msg) -> void;
+    auto decode(scan& msg, decode_mode mode = decode_mode::full) -> void;
+
+    /// Copy the raw wire format of the current message
+    /** This may be used to defer decoding of a message until after it has been released from the connection
+     *  buffer, for example to decode it on another thread.  Messages of any type may be copied. */
+    auto decode_raw(std::vector<uint8_t>& raw) -> void;
+
+    /// Get a snapshot of the connection statistics
+    /** Like the other const member functions this may be called from any thread at any time.  Since each counter
+     *  is sampled individually the snapshot is not guaranteed to be consistent between counters. */
+    auto stats() const -> client_stats;
+
+    /// Set a function to be called periodically with the connection statistics
+    /** The function is called from process_traffic() on the communications thread at most once per period
+     *  (seconds).  Monitoring the buffer_full and buffer_high_water statistics allows a handler thread which is
+     *  falling behind to be detected before the buffer overflows.  Pass nullptr to remove the callback. */
+    auto set_stats_callback(stats_fn fn, time_t period = 60) -> void;
 
   private:
     using filter_store = std::vector<std::string>;
-    using buffer = std::unique_ptr<uint8_t[]>;
+    struct buffer_deleter
+    {
+      size_t size;
+      auto operator()(uint8_t* ptr) const -> void;
+    };
+    using buffer = std::unique_ptr<uint8_t[], buffer_deleter>;
+
+    struct resolver;
+
+    struct endpoint
+    {
+      int                   family;
+      int                   socktype;
+      int                   protocol;
+      std::vector<uint8_t>  addr;     // raw sockaddr
+    };
+
+    // each counter is only ever written by one thread so relaxed atomics are sufficient
+    struct counters
+    {
+      counters();
+
+      std::atomic<uint64_t> connects;
+      std::atomic<uint64_t> disconnects;
+      std::atomic<uint64_t> bytes_received;
+      std::atomic<uint64_t> bytes_sent;
+      std::atomic<uint64_t> recv_calls;
+      std::atomic<uint64_t> keepalives_sent;
+      std::atomic<uint64_t> keepalive_replies;
+      std::atomic<uint64_t> keepalive_rtt;
+      std::atomic<uint64_t> keepalive_sent_at; // time the unanswered keepalive was queued (0 if none, written by both)
+      std::atomic<uint64_t> mssgs_dequeued;
+      std::atomic<uint64_t> scans_dequeued;
+      std::atomic<uint64_t> buffer_full;
+      std::atomic<uint64_t> buffer_grows;
+      std::atomic<uint64_t> buffer_high_water;
+      std::atomic<uint64_t> traffic_time;
+      std::atomic<uint64_t> dequeue_time;
+      std::atomic<uint64_t> decode_time;
+      std::atomic<uint64_t> decode_histogram[16];
+      std::atomic<time_t>   last_activity;
+    };
 
   private:
+    auto restore_stats(client_stats const& val) -> void;
+    auto begin_connect() -> void;
+    auto start_resolve() -> void;
+    auto finish_resolve() -> void;
+    auto open_socket() -> void;
+    auto close_socket() -> void;
+    auto drop() -> void;
     auto check_cur_type(message_type type) -> void;
+    auto buffer_grow() -> bool;
     auto buffer_ignore_whitespace() -> void;
-    auto buffer_starts_with(std::string const& str) const -> bool;
-    auto buffer_find(std::string const& str, size_t& pos) const -> bool;
+    auto buffer_starts_with(std::string const& str, size_t wc) const -> bool;
+    auto buffer_find(std::string const& str, size_t wc, size_t& pos) -> bool;
 
   private:
     std::string             address_;             // remote hostname or address
     std::string             service_;             // remote service or port number
     time_t                  keepalive_period_;    // time between sending keepalives
     time_t                  inactivity_timeout_;  // drop connection after this long without incoming data
+    int                     rcvbuf_;              // requested socket receive buffer size (0 for kernel default)
     filter_store            filters_;             // filter strings
     int                     socket_;              // socket handle
     rapic::connection_state state_;               // current connection state
     time_t                  last_keepalive_;      // time of last keepalive send
     time_t                  last_activity_;       // time of last data received
+    std::shared_ptr<resolver> resolver_;          // address lookup in progress (shared with lookup thread)
+    std::vector<endpoint>   endpoints_;           // cached resolved addresses of the server
+    size_t                  next_endpoint_;       // index of the next address to try
+    time_t                  resolved_at_;         // time the address cache was filled
+    time_t                  attempt_start_;       // time the current connection attempt was started
+    time_t                  reconnect_min_;       // initial delay before reconnecting
+    time_t                  reconnect_max_;       // maximum delay before reconnecting (0 disables reconnection)
+    time_t                  reconnect_delay_;     // delay to use after the next failure
+    time_t                  reconnect_at_;        // time of next reconnection attempt
+    counters                stats_;               // connection statistics
+    stats_fn                stats_fn_;            // callback used to report statistics
+    time_t                  stats_period_;        // time between calls to the statistics callback
+    time_t                  last_stats_;          // time of last call to the statistics callback
 
     std::string             wbuffer_;             // buffer of data waiting for output
 
-    buffer                  buffer_;              // ring buffer to store packets off the wire
-    size_t                  capacity_;            // total usable buffer capacity
+    buffer                  buffer_;              // ring buffer to store packets off the wire (mapped twice in a row)
+    std::atomic_size_t      capacity_;            // total usable buffer capacity
+    size_t                  max_capacity_;        // limit to which the buffer may grow
+    std::string             spill_dir_;           // directory used to back grown buffers (empty for memory)
+    std::mutex              buffer_mutex_;        // held while writing to the buffer or replacing it
     std::atomic_size_t      wcount_;              // total bytes that have been written (wraps)
     std::atomic_size_t      rcount_;              // total bytes that have been read (wraps)
+    std::atomic_size_t      discard_at_;          // write count at which the last lost connection ended
+    std::atomic_bool        discard_pending_;     // whether dequeue() must discard data up to discard_at_
 
     message_type            cur_type_;            // type of currently dequeued message (awaiting decode)
     size_t                  cur_size_;            // size of currently dequeued message
+    std::string const*      search_term_;         // terminator being searched for in the next message
+    size_t                  search_pos_;          // offset from rcount_ at which to resume the terminator search
+
+    friend class decode_pool;
+  };
+
+  /// Multiplexed manager for a set of rapic client connections
+  /** This class owns a set of client connections and services the traffic for all of them using a single epoll
+   *  instance.  This allows a single communications thread to manage many feeds with minimal wakeup overhead.
+   *
+   *  The basic synchronous usage sequence is:
+   *    // create the pool and add a connection for each server
+   *    client_pool pool;
+   *    auto& con = pool.add(client{});
+   *    con.add_filter(-1, "ANY");
+   *    con.connect("myhost", "1234");
+   *    ...
+   *
+   *    while (true) {
+   *      // wait for data to arrive on any connection
+   *      pool.poll();
+   *
+   *      // process traffic and handle messages from all connections
+   *      bool again = true;
+   *      while (again) {
+   *        again = pool.process_traffic([](client& con, std::exception const& err) { ... });
+   *
+   *        client* con;
+   *        message_type type;
+   *        while (pool.dequeue(con, type)) {
+   *          if (type == message_type::scan) {
+   *            scan msg;
+   *            con->decode(msg);
+   *            ...
+   *          }
+   *        }
+   *      }
+   *    }
+   *
+   * The pool follows the same threading rules as the client class.  The poll() and process_traffic() functions
+   * must be called from a single communications thread, while dequeue() (and decode() on the returned client)
+   * must be called from a single message handling thread.  The add() and remove() functions must not be called
+   * at the same time as any other member function.
+   *
+   * Clients may be connected, disconnected and reconnected freely by the user while they are in the pool.  The
+   * pool will update its registration for each connection at the next call to poll().
+   */
+  class client_pool
+  {
+  public:
+    /// Function used to report an error which caused a connection to be dropped
+    using error_fn = std::function<void(client&, std::exception const&)>;
+
+  public:
+    /// Construct an empty pool
+    client_pool();
+
+    client_pool(client_pool const&) = delete;
+    auto operator=(client_pool const&) -> client_pool& = delete;
+
+    /// Destroy the pool and all of the clients it contains
+    ~client_pool();
+
+    /// Add a client to the pool
+    /** The returned reference remains valid until the client is removed from the pool. */
+    auto add(client con) -> client&;
+
+    /// Remove a client from the pool
+    auto remove(client const& con) -> void;
+
+    /// Get the number of clients in the pool
+    auto size() const -> size_t;
+
+    /// Get the epoll file descriptor which may be used for multiplexed polling
+    /** The descriptor becomes readable whenever any of the clients in the pool require attention.  Note that
+     *  poll() must still be called before process_traffic() to update the set of monitored connections. */
+    auto pollable_fd() const -> int;
+
+    /// Wait (block) until some traffic arrives on any connection for processing
+    /** The optional timeout parameter may be supplied to force the function to return after a cerain number
+     *  of milliseconds.  The default is 10 seconds. */
+    auto poll(int timeout = 10000) -> void;
+
+    /// Process traffic on each connection which is ready (may cause new messages to be available for dequeue)
+    /** If any connection encounters an error it will be disconnected and the error passed to the supplied
+     *  error function.  If no error function is supplied then the exception is rethrown after the offending
+     *  connection has been disconnected.
+     *
+     *  If this function returns false then there is no more data currently available on any socket.  The
+     *  return value has the same meaning as client::process_traffic(). */
+    auto process_traffic(error_fn on_error = nullptr) -> bool;
+
+    /// Dequeue the next available message from any connection
+    /** If no message is available, the function returns false.  Otherwise the connection that the message
+     *  belongs to is returned in the con argument and may be used to decode the message.  Connections are
+     *  visited in round robin order so that a busy feed cannot starve the others. */
+    auto dequeue(client*& con, message_type& type) -> bool;
+
+  private:
+    struct entry
+    {
+      entry(client&& con) : con(std::move(con)), fd{-1}, events{0}, ready{false} { }
+
+      client    con;      // the connection
+      int       fd;       // file descriptor currently registered with epoll (or -1)
+      uint32_t  events;   // events currently registered with epoll
+      bool      ready;    // whether the connection needs traffic processing
+    };
+    using entry_store = std::list<entry>;
+
+  private:
+    auto update_registration(entry& e) -> void;
+    auto forget_registration(entry& e) -> void;
+
+  private:
+    int                   epoll_fd_;    // epoll instance handle
+    entry_store           entries_;     // pooled connections
+    entry_store::iterator cursor_;      // next connection to check for messages
+    time_t                last_sweep_;  // time that all connections were last processed
+  };
+
+  /// Rapic Data Server for publishing messages to clients
+  /** This class implements the server side of the protocol.  It accepts connections from clients, processes their
+   *  RPQUERY and RPFILTER requests and publishes scans and MSSG messages to each connection whose filters match.
+   *  It is intended as a lightweight stand-in for a ROWLF server when testing clients and for re-serving scans
+   *  to downstream consumers.
+   *
+   *  The basic usage sequence is:
+   *    server srv;
+   *    srv.listen("", "15555");
+   *
+   *    while (true) {
+   *      // wait for client traffic or until it is time to publish something
+   *      srv.poll(100);
+   *      srv.process_traffic();
+   *
+   *      // publish messages to interested clients
+   *      scan msg;
+   *      ...
+   *      srv.publish(msg);
+   *    }
+   *
+   *  Only semi-permanent connections are supported.  Any RPQUERY request enables the stream of new messages for
+   *  a connection, and historical data requests are ignored.  A connection which has not sent any RPFILTER
+   *  requests receives every scan, otherwise it receives only the scans which match at least one of its filters.
+   *  MSSG messages are sent to every connection which has sent an RPQUERY.
+   *
+   *  Published messages are queued for each connection and written out by process_traffic().  The encoded form
+   *  of each message is shared between connections, so publishing to many clients costs little more than
+   *  publishing to one.  Connections which fall too far behind, or which stop sending keepalives, are dropped.
+   *
+   *  This class is not thread safe.  All member functions must be called from the same thread.
+   */
+  class server
+  {
+  public:
+    /// Encoded message which may be shared between many connections
+    using message_ptr = std::shared_ptr<std::vector<uint8_t> const>;
+
+  public:
+    /// Construct a server which is not yet listening
+    /** Connections with more than max_queued bytes waiting to be written are dropped, as are connections which
+     *  send nothing (not even a keepalive) for the inactivity timeout period. */
+    server(size_t max_queued = 64 * 1024 * 1024, time_t inactivity_timeout = 120);
+
+    server(server const&) = delete;
+    auto operator=(server const&) -> server& = delete;
+
+    /// Stop listening and close all connections
+    ~server();
+
+    /// Listen for connections on the given address and service
+    /** An empty address listens on all local interfaces.  A service of "0" will listen on a port chosen by the
+     *  system which may be retrieved by calling port(). */
+    auto listen(std::string const& address, std::string const& service) -> void;
+
+    /// Stop listening and close all connections
+    auto shutdown() -> void;
+
+    /// Get the port number that the server is listening on (or -1 if not listening)
+    auto port() const -> int;
+
+    /// Get the number of connected clients which have requested the message stream
+    auto connections() const -> size_t;
+
+    /// Get the total number of bytes waiting to be written across all connections
+    auto queued() const -> size_t;
+
+    /// Get the epoll file descriptor which may be used for multiplexed polling
+    auto pollable_fd() const -> int                                   { return epoll_fd_; }
+
+    /// Wait (block) until there is traffic for processing
+    /** The optional timeout parameter may be supplied to force the function to return after a cerain number
+     *  of milliseconds.  The default is 10 seconds. */
+    auto poll(int timeout = 10000) -> void;
+
+    /// Accept new connections, process client requests and write queued messages
+    /** If this function returns true then there is more traffic waiting to be processed immediately. */
+    auto process_traffic() -> bool;
+
+    /// Publish a scan to every connection which is interested in it
+    /** The scan is encoded once using the given ray encoding and then shared between all connections. */
+    auto publish(scan const& msg, ray_encoding encoding = ray_encoding::compact) -> void;
+
+    /// Publish an already encoded scan to every connection which is interested in it
+    /** The scan is used only to match connection filters, so it may have been decoded in headers_only mode.  The
+     *  raw message must contain the complete wire format of the scan. */
+    auto publish(scan const& msg, message_ptr raw) -> void;
+
+    /// Publish a MSSG message to every connection
+    /** The content must contain the complete wire format of the message as returned by client::decode(). */
+    auto publish(mssg const& msg) -> void;
+
+  private:
+    struct filter
+    {
+      int                       station;  // station number (-1 for any)
+      std::string               product;  // product type
+      std::vector<std::string>  moments;  // moments to send (empty for all)
+    };
+
+    struct connection
+    {
+      int                     fd;             // socket handle
+      uint32_t                events;         // events currently registered with epoll
+      bool                    ready;          // whether the connection needs traffic processing
+      bool                    active;         // whether the stream has been requested via RPQUERY
+      std::vector<filter>     filters;        // filters requested via RPFILTER
+      std::string             rbuffer;        // partial request line waiting for completion
+      std::deque<message_ptr> wqueue;         // messages waiting to be written
+      size_t                  woffset;        // bytes of the first queued message already written
+      size_t                  wsize;          // total bytes waiting to be written
+      time_t                  last_activity;  // time of last data received
+    };
+    using connection_store = std::list<connection>;
+
+  private:
+    auto accept_connections() -> void;
+    auto read_requests(connection& con, time_t now) -> bool;
+    auto handle_request(connection& con, std::string const& line) -> void;
+    auto write_messages(connection& con) -> void;
+    auto enqueue(connection& con, message_ptr const& msg) -> bool;
+    auto update_registration(connection& con) -> void;
+    auto drop(connection_store::iterator i) -> connection_store::iterator;
+    static auto matches(connection const& con, scan const& msg) -> bool;
+
+  private:
+    size_t            max_queued_;          // maximum bytes waiting to be written before a connection is dropped
+    time_t            inactivity_timeout_;  // drop connection after this long without incoming data
+    int               epoll_fd_;            // epoll instance handle
+    int               listen_fd_;           // listening socket handle
+    bool              listen_ready_;        // whether there may be connections waiting to be accepted
+    connection_store  connections_;         // active connections
+    time_t            last_sweep_;          // time that all connections were last processed
+  };
+
+  /// Pool of worker threads used to decode scans in parallel
+  /** Scans are submitted for decoding from the message handling thread as they are dequeued from a client (or
+   *  client_pool).  The raw message is copied out of the connection buffer so that the client may continue to
+   *  receive data immediately.  Decoded scans are returned by dequeue() strictly in the order they were submitted
+   *  regardless of which worker finished first.
+   *
+   *  A typical usage sequence is:
+   *    decode_pool decoder;
+   *    ...
+   *    while (con.dequeue(type)) {
+   *      if (type == message_type::scan)
+   *        decoder.enqueue(con);
+   *    }
+   *
+   *    scan msg;
+   *    while (decoder.dequeue(msg)) {
+   *      ...
+   *    }
+   *
+   *  The enqueue() and dequeue() functions may be called from different threads, however each must only be called
+   *  from a single thread at a time.  Scan objects passed to dequeue() are recycled internally so that their
+   *  allocated capacity is reused by subsequent decodes.
+   */
+  class decode_pool
+  {
+  public:
+    /// Construct a pool with the given number of worker threads
+    /** If threads is 0 then one worker thread is created for each hardware thread available. */
+    decode_pool(size_t threads = 0);
+
+    decode_pool(decode_pool const&) = delete;
+    auto operator=(decode_pool const&) -> decode_pool& = delete;
+
+    /// Stop the worker threads and discard any scans which have not been dequeued
+    ~decode_pool();
+
+    /// Submit the scan message currently dequeued by a client for decoding
+    /** If the message currently dequeued by the client is not a scan then a runtime exception will be thrown. */
+    auto enqueue(client& con) -> void;
+
+    /// Submit a raw scan message for decoding
+    auto enqueue(uint8_t const* in, size_t size) -> void;
+
+    /// Retrieve the next decoded scan in submission order
+    /** If the next scan has not yet finished decoding then the function will either block until it has (if
+     *  wait is true) or return false immediately.  If no scans are outstanding the function always returns false.
+     *  If the scan failed to decode then the exception thrown by scan::decode() is rethrown by this function and
+     *  the failed scan is discarded. */
+    auto dequeue(scan& msg, bool wait = false) -> bool;
+
+    /// Get the number of scans which have been submitted but not yet dequeued
+    auto pending() const -> size_t;
+
+  private:
+    struct job
+    {
+      std::vector<uint8_t>  raw;    // raw message awaiting decode
+      scan                  msg;    // decoded message
+      std::exception_ptr    err;    // exception thrown during decoding
+      bool                  done;   // whether the decode is complete
+    };
+    using job_ptr = std::unique_ptr<job>;
+
+  private:
+    auto acquire() -> job_ptr;
+    auto submit(job_ptr j) -> void;
+    auto worker() -> void;
+
+  private:
+    std::vector<std::thread>  threads_;   // worker threads
+    mutable std::mutex        mutex_;     // protects all members below
+    std::condition_variable   work_cv_;   // signalled when new work arrives or we are stopping
+    std::condition_variable   done_cv_;   // signalled when a decode completes
+    std::deque<job_ptr>       jobs_;      // outstanding jobs in submission order
+    size_t                    next_;      // index into jobs_ of the next job to be started
+    std::vector<job_ptr>      spare_;     // completed jobs available for reuse
+    bool                      stop_;      // whether worker threads should exit
+  };
+
+  /// Sequential reader for rapic archive files
+  /** The file is memory mapped rather than loaded into memory, so archives of any size may be processed with a
+   *  small resident footprint and decoding begins immediately.  Scans are decoded directly from the mapping.
+   *  Whitespace and image header lines (those beginning with '/') between scans are skipped.
+   *
+   *  The basic usage sequence is:
+   *    file_reader in{"archive.rapic"};
+   *    scan msg;
+   *    while (in.read(msg)) {
+   *      ...
+   *    }
+   */
+  class file_reader
+  {
+  public:
+    /// Open and map the file at the given path
+    file_reader(std::string const& path);
+
+    file_reader(file_reader const&) = delete;
+    auto operator=(file_reader const&) -> file_reader& = delete;
+
+    /// Unmap the file
+    ~file_reader();
+
+    /// Get the total size of the file in bytes
+    auto size() const -> size_t                                       { return size_; }
+
+    /// Get the current read position within the file
+    auto position() const -> size_t                                   { return pos_; }
+
+    /// Locate the next scan without decoding it
+    /** On success data and size are set to the raw wire format of the scan within the mapping.  This pointer
+     *  remains valid for the lifetime of the reader and may be used to decode the scan later or on another thread.
+     *  Returns false once the end of the file has been reached. */
+    auto next(uint8_t const*& data, size_t& size) -> bool;
+
+    /// Decode the next scan
+    /** Returns false once the end of the file has been reached. */
+    auto read(scan& msg, decode_mode mode = decode_mode::full) -> bool;
+
+  private:
+    uint8_t*  data_;  // file mapping
+    size_t    size_;  // size of file
+    size_t    pos_;   // read position
+  };
+
+  /// Assembler which groups individual scans into volumes as they arrive
+  /** Scans are grouped by station, product, volume identifier and pass count.  A volume is made ready as soon as
+   *  every pass from 1 to pass_count() has been received, with the scans sorted into pass order as expected by
+   *  write_odim_h5_volume().  Volumes which do not receive a new pass within the timeout period are made ready
+   *  incomplete, which may be detected by comparing the number of scans to pass_count().  Scans which do not
+   *  carry valid pass information are made ready immediately as a volume of one scan.
+   *
+   *  A typical usage sequence is:
+   *    volume_assembler assembler;
+   *    ...
+   *    scan msg;
+   *    con.decode(msg);
+   *    assembler.add(std::move(msg));
+   *
+   *    std::list<scan> volume;
+   *    while (assembler.dequeue(volume)) {
+   *      ...
+   *    }
+   */
+  class volume_assembler
+  {
+  public:
+    /// Construct an assembler with the given timeout for incomplete volumes (seconds)
+    volume_assembler(time_t timeout = 600);
+
+    /// Add a scan to the volume it belongs to
+    /** If the pass has already been received for the volume then the previous scan is replaced. */
+    auto add(scan msg) -> void;
+
+    /// Retrieve the next volume which is ready
+    /** Returns false if no volume is ready.  Volumes are returned in the order in which they became ready. */
+    auto dequeue(std::list<scan>& volume) -> bool;
+
+    /// Make all partially assembled volumes ready immediately regardless of the timeout
+    auto flush() -> void;
+
+    /// Get the number of volumes which are partially assembled
+    auto pending() const -> size_t                                    { return partials_.size(); }
+
+  private:
+    struct partial
+    {
+      std::list<scan> scans;        // received passes sorted by pass number
+      time_t          last_update;  // time that the last pass was received
+    };
+
+  private:
+    auto expire(time_t now) -> void;
+
+  private:
+    time_t                      timeout_;   // time to wait for the next pass of a volume
+    std::list<partial>          partials_;  // volumes being assembled
+    std::deque<std::list<scan>> ready_;     // volumes ready to be dequeued
   };
 
   auto parse_volumetric_header(std::string const& product) -> time_t;
 
+  /// Dataset creation settings used when writing ODIM_H5 files
+  /** These settings trade file size against CPU time.  A compression level of zero gives an uncompressed fast mode
+   *  suitable for latency critical use, while higher levels suit archival.
+   *
+   *  The odim_h5 library does not yet accept dataset creation options when appending a dataset, so the settings
+   *  are currently validated but not applied.  A warning is reported through the log function of
+   *  write_odim_h5_volume() whenever a non-default setting is requested. */
+  struct odim_options
+  {
+    odim_options() : chunk_rays{0}, compression{-1}, shuffle{false} { }
+
+    size_t  chunk_rays;   ///< Number of rays stored in each chunk (0 for the library default)
+    int     compression;  ///< Deflate level from 0 (uncompressed) to 9 (-1 for the library default)
+    bool    shuffle;      ///< Apply the shuffle filter before compression
+  };
+
   /// Write a list of rapic scans as an ODIM_H5 polar volume file
   /**
    * This function assumes the following preconditions about the scan_set:
@@ -386,12 +1171,13 @@ namespace rapic
    * written to the ODIM group dataset1/data1.
    *
    * A custom function may be provided in the third argument to provide a mechanism for reporting warnings
-   * during the conversion process.
+   * during the conversion process.  The dataset creation settings may be supplied in the fourth argument.
    */
   auto write_odim_h5_volume(
         std::string const& path
       , std::list<scan> const& scan_set
       , std::function<void(char const*)> log_fn = [](char const*) { }
+      , odim_options const& options = odim_options{}
       ) -> time_t;
 }
 #endif
@@ -18,10 +18,16 @@
 #include "rapic.h"
 
 #include <getopt.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #include <cstdio>
+#include <cstring>
 #include <iostream>
+#include <iterator>
 #include <sstream>
 #include <system_error>
+#include <utility>
+#include <vector>
 
 static const char* try_again = "try --help for usage instructions\n";
 static const char* usage_string =
@@ -46,14 +52,18 @@ available options:
 
   -a, --archive
       Convert a multi-scan rapic archive file
+
+  -j, --jobs N
+      Convert up to N volumes concurrently in archive mode (default 1)
 )";
 
-static const char* short_options = "hqa";
+static const char* short_options = "hqaj:";
 static struct option long_options[] =
 {
     { "help",    no_argument, 0, 'h' }
   , { "quiet",   no_argument, 0, 'q' }
   , { "archive", no_argument, 0, 'a' }
+  , { "jobs",    required_argument, 0, 'j' }
   , { 0, 0, 0, 0 }
 };
 
@@ -88,9 +98,120 @@ auto log_function(char const* msg) -> void
     std::cout << msg << std::endl;
 }
 
+auto write_archive_volume(char const* path_output, std::list<rapic::scan> const& vol_scans) -> void
+{
+  // build a file name for this volume
+  auto t = rapic::parse_volumetric_header(vol_scans.begin()->product());
+  auto tmm = gmtime(&t);
+  char path[BUFSIZ];
+  snprintf(
+        path
+      , BUFSIZ
+      , "%s/%d_%04d%02d%02d_%02d%02d00.pvol.h5"
+      , path_output
+      , vol_scans.begin()->station_id()
+      , tmm->tm_year + 1900
+      , tmm->tm_mon + 1
+      , tmm->tm_mday
+      , tmm->tm_hour
+      , tmm->tm_min);
+
+  std::cout << "writing " << path << std::endl;
+
+  // convert the list of scans into a volume
+  rapic::write_odim_h5_volume(path, vol_scans, log_function);
+}
+
+// raw scans of each volume within the mapped archive
+using volume_list = std::vector<std::vector<std::pair<uint8_t const*, size_t>>>;
+
+// decode and write every nth volume starting from first, returning the process exit status
+auto convert_volumes(char const* path_output, volume_list const& volumes, size_t first, size_t stride) -> int
+try
+{
+  for (auto i = first; i < volumes.size(); i += stride)
+  {
+    std::list<rapic::scan> vol_scans;
+    for (auto& raw : volumes[i])
+    {
+      vol_scans.emplace_back();
+      vol_scans.back().decode(raw.first, raw.second);
+    }
+    write_archive_volume(path_output, vol_scans);
+  }
+  return EXIT_SUCCESS;
+}
+catch (std::exception& err)
+{
+  if (!quiet)
+    std::cout << "fatal exception: " << format_exception(err) << std::endl;
+  return EXIT_FAILURE;
+}
+
+// convert the volumes of an archive using multiple worker processes
+/* the HDF5 library is not generally thread safe, so concurrent writes are achieved by forking a process for each
+ * job rather than using threads.  the workers share the read only mapping of the input file. */
+auto convert_archive_parallel(rapic::file_reader& in, char const* path_output, size_t jobs) -> int
+{
+  // locate the scans and group them into volumes using a cheap header only decode
+  volume_list volumes;
+  rapic::scan hdr;
+  std::string product;
+  uint8_t const* data;
+  size_t size;
+  while (in.next(data, size))
+  {
+    hdr.decode(data, size, rapic::decode_mode::headers_only);
+    if (volumes.empty() || hdr.product() != product)
+    {
+      volumes.emplace_back();
+      product = hdr.product();
+    }
+    volumes.back().emplace_back(data, size);
+  }
+
+  // start the workers
+  std::vector<pid_t> workers;
+  int ret = EXIT_SUCCESS;
+  std::cout.flush();
+  for (size_t i = 0; i < jobs && i < volumes.size(); ++i)
+  {
+    auto pid = fork();
+    if (pid == 0)
+    {
+      auto status = convert_volumes(path_output, volumes, i, jobs);
+      std::cout.flush();
+      _exit(status);
+    }
+    if (pid == -1)
+    {
+      if (!quiet)
+        std::cout << "fatal exception: failed to start worker process: " << strerror(errno) << std::endl;
+      ret = EXIT_FAILURE;
+      break;
+    }
+    workers.push_back(pid);
+  }
+
+  // wait for them all to finish
+  for (auto pid : workers)
+  {
+    int status;
+    while (waitpid(pid, &status, 0) == -1)
+    {
+      if (errno != EINTR)
+        throw std::system_error{errno, std::system_category(), "failed to wait for worker process"};
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+      ret = EXIT_FAILURE;
+  }
+  return ret;
+}
+
 int main(int argc, char* argv[])
 {
   bool archive = false;
+  size_t jobs = 1;
 
   // process options
   while (true)
@@ -110,6 +231,18 @@ int main(int argc, char* argv[])
     case 'a':
       archive = true;
       break;
+    case 'j':
+      {
+        char* end;
+        auto val = strtol(optarg, &end, 10);
+        if (*end != '\0' || val < 1)
+        {
+          std::cerr << "invalid job count\n" << try_again;
+          return EXIT_FAILURE;
+        }
+        jobs = val;
+      }
+      break;
     case '?':
       std::cerr << try_again;
       return EXIT_FAILURE;
@@ -125,88 +258,48 @@ int main(int argc, char* argv[])
   auto path_input = argv[optind + 0];
   auto path_output = argv[optind + 1];
 
-  FILE* fin = nullptr;
   try
   {
-    // read the entire input file into memory
-    fin = fopen(path_input, "rb");
-    if (!fin)
-      throw std::system_error{errno, std::system_category(), "failed to open input file"};
-
-    if (fseek(fin, 0, SEEK_END) != 0)
-      throw std::system_error{errno, std::system_category(), "failed to read input file"};
-
-    auto l = ftell(fin);
-    if (l == -1)
-      throw std::system_error{errno, std::system_category(), "failed to read input file"};
-    size_t len = l;
-
-    std::unique_ptr<uint8_t[]> buf{new uint8_t[len]};
-
-    if (fseek(fin, 0, SEEK_SET) != 0)
-      throw std::system_error{errno, std::system_category(), "failed to read input file"};
-
-    if (fread(buf.get(), 1, len, fin) != len)
-      throw std::system_error{errno, std::system_category(), "failed to read input file"};
-
-    // find scans and parse them into a list
+    rapic::file_reader in{path_input};
     std::list<rapic::scan> scans;
-    for (size_t i = 0; i < len; ++i)
-    {
-      // whitespace - skip
-      if (buf[i] <= 20)
-        continue;
-
-      // image header - skip
-      if (buf[i] == '/')
-      {
-        while (i < len && buf[i] != '\n')
-          ++i;
-        continue;
-      }
 
-      // scan - find end and decode
-      scans.emplace_back();
-      i += scans.back().decode(&buf[i], len - i);
+    if (archive && jobs > 1)
+    {
+      return convert_archive_parallel(in, path_output, jobs);
     }
-
-    if (archive)
+    else if (archive)
     {
-      while (!scans.empty())
+      // convert each volume as soon as it is complete so that only one volume is held in memory at a time
+      bool more = true;
+      while (more)
       {
-        // find end of this volume
-        auto end = scans.begin();
-        while (end != scans.end() && end->product() == scans.begin()->product())
-          ++end;
-
-        // splice these scans into a separate list
-        std::list<rapic::scan> vol_scans;
-        vol_scans.splice(vol_scans.begin(), scans, scans.begin(), end);
-
-        // build a file name for this volume
-        auto t = rapic::parse_volumetric_header(vol_scans.begin()->product());
-        auto tmm = gmtime(&t);
-        char path[BUFSIZ];
-        snprintf(
-              path
-            , BUFSIZ
-            , "%s/%d_%04d%02d%02d_%02d%02d00.pvol.h5"
-            , path_output
-            , vol_scans.begin()->station_id()
-            , tmm->tm_year + 1900
-            , tmm->tm_mon + 1
-            , tmm->tm_mday
-            , tmm->tm_hour
-            , tmm->tm_min);
-
-        std::cout << "writing " << path << std::endl;
-
-        // convert the list of scans into a volume
-        rapic::write_odim_h5_volume(path, vol_scans, log_function);
+        scans.emplace_back();
+        more = in.read(scans.back());
+        if (!more)
+          scans.pop_back();
+
+        // the volume is complete once we reach the end of file or a scan from a different product
+        if (!scans.empty() && (!more || scans.back().product() != scans.front().product()))
+        {
+          std::list<rapic::scan> vol_scans;
+          vol_scans.splice(vol_scans.begin(), scans, scans.begin(), more ? std::prev(scans.end()) : scans.end());
+          write_archive_volume(path_output, vol_scans);
+        }
       }
     }
     else
     {
+      // parse each scan into a list
+      while (true)
+      {
+        scans.emplace_back();
+        if (!in.read(scans.back()))
+        {
+          scans.pop_back();
+          break;
+        }
+      }
+
       // convert the list of scans into a volume
       rapic::write_odim_h5_volume(path_output, scans, log_function);
     }
@@ -224,9 +317,5 @@ int main(int argc, char* argv[])
     return EXIT_FAILURE;
   }
 
-  // ensure the input file is closed nicely
-  if (fin)
-    fclose(fin);
-
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,218 @@
+/*------------------------------------------------------------------------------
+ * Rapic Protocol Support Library
+ *
+ * Copyright 2016 Commonwealth of Australia, Bureau of Meteorology
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *----------------------------------------------------------------------------*/
+#include "rapic.h"
+
+#include <getopt.h>
+#include <poll.h>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+
+static const char* try_again = "try --help for usage instructions\n";
+static const char* usage_string =
+R"(Rapic fan-out relay
+
+usage:
+  rapic_relay [options] host port
+
+note:
+  This program maintains a single connection to an upstream rapic server and re-serves
+  the messages it receives to any number of downstream clients.  The filters requested
+  by each downstream client are applied locally by the relay.  If the upstream
+  connection is lost it is automatically re-established with an increasing delay of up to
+  10 seconds.
+
+available options:
+  -h, --help
+      Show this message and exit
+
+  -q, --quiet
+      Suppress output of upstream connection status and errors
+
+  -a, --address ADDR
+      Address to listen on for downstream clients (default all local interfaces)
+
+  -p, --port SERVICE
+      Port or service to listen on for downstream clients (default 15555)
+
+  -f, --filter STATION:PRODUCT
+      Restrict the upstream subscription to the given station and product type.  May be
+      supplied multiple times.  By default all products from all stations are requested
+)";
+
+static const char* short_options = "hqa:p:f:";
+static struct option long_options[] =
+{
+    { "help",    no_argument, 0, 'h' }
+  , { "quiet",   no_argument, 0, 'q' }
+  , { "address", required_argument, 0, 'a' }
+  , { "port",    required_argument, 0, 'p' }
+  , { "filter",  required_argument, 0, 'f' }
+  , { 0, 0, 0, 0 }
+};
+
+// maximum time to wait before reconnecting to the upstream server
+constexpr time_t reconnect_delay = 10;
+
+bool quiet = false;
+
+auto relay_messages(rapic::client& con, rapic::server& srv, rapic::scan& msg) -> void
+{
+  rapic::message_type type;
+  while (con.dequeue(type))
+  {
+    if (type == rapic::message_type::mssg)
+    {
+      rapic::mssg m;
+      con.decode(m);
+      srv.publish(m);
+    }
+    else
+    {
+      // copy the message out of the connection buffer once and share it between all downstream clients
+      std::vector<uint8_t> raw;
+      con.decode_raw(raw);
+      try
+      {
+        // only the headers are needed to match downstream filters
+        msg.decode(raw.data(), raw.size(), rapic::decode_mode::headers_only);
+      }
+      catch (std::exception& err)
+      {
+        if (!quiet)
+          std::cerr << "discarding bad scan: " << err.what() << std::endl;
+        continue;
+      }
+      srv.publish(msg, std::make_shared<std::vector<uint8_t> const>(std::move(raw)));
+    }
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  std::string address;
+  std::string service = "15555";
+  rapic::client con;
+  bool filtered = false;
+
+  // process options
+  while (true)
+  {
+    int option_index = 0;
+    int c = getopt_long(argc, argv, short_options, long_options, &option_index);
+    if (c == -1)
+      break;
+    switch (c)
+    {
+    case 'h':
+      std::cout << usage_string;
+      return EXIT_SUCCESS;
+    case 'q':
+      quiet = true;
+      break;
+    case 'a':
+      address = optarg;
+      break;
+    case 'p':
+      service = optarg;
+      break;
+    case 'f':
+      {
+        char* end;
+        auto station = strtol(optarg, &end, 10);
+        if (end == optarg || *end != ':' || end[1] == '\0')
+        {
+          std::cerr << "invalid filter\n" << try_again;
+          return EXIT_FAILURE;
+        }
+        con.add_filter(station, end + 1);
+        filtered = true;
+      }
+      break;
+    case '?':
+      std::cerr << try_again;
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (argc - optind < 2)
+  {
+    std::cerr << "missing required parameters\n" << try_again;
+    return EXIT_FAILURE;
+  }
+
+  if (!filtered)
+    con.add_filter(-1, "ANY");
+
+  try
+  {
+    rapic::server srv;
+    srv.listen(address, service);
+
+    // connect to the upstream server, the client takes care of reconnecting from here on
+    con.set_reconnect(1, reconnect_delay);
+    try
+    {
+      if (!quiet)
+        std::cout << "connecting to " << argv[optind] << ":" << argv[optind + 1] << std::endl;
+      con.connect(argv[optind], argv[optind + 1]);
+    }
+    catch (std::exception& err)
+    {
+      if (!quiet)
+        std::cerr << "failed to connect upstream: " << err.what() << std::endl;
+    }
+
+    rapic::scan msg;
+    while (true)
+    {
+      // wait for traffic on either the upstream or downstream sockets
+      pollfd fds[2];
+      fds[0].fd = srv.pollable_fd();
+      fds[0].events = POLLIN;
+      fds[1].fd = con.pollable_fd();
+      fds[1].events = POLLRDHUP | (con.poll_read() ? POLLIN : 0) | (con.poll_write() ? POLLOUT : 0);
+      ::poll(fds, con.pollable_fd() == -1 ? 1 : 2, 1000);
+
+      // relay everything available from upstream
+      try
+      {
+        while (con.process_traffic())
+          relay_messages(con, srv, msg);
+        relay_messages(con, srv, msg);
+      }
+      catch (std::exception& err)
+      {
+        if (!quiet)
+          std::cerr << "upstream connection lost: " << err.what() << std::endl;
+      }
+
+      // service the downstream clients
+      srv.poll(0);
+      while (srv.process_traffic())
+        ;
+    }
+  }
+  catch (std::exception& err)
+  {
+    std::cerr << "fatal error: " << err.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
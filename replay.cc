@@ -0,0 +1,325 @@
+/*------------------------------------------------------------------------------
+ * Rapic Protocol Support Library
+ *
+ * Copyright 2016 Commonwealth of Australia, Bureau of Meteorology
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *----------------------------------------------------------------------------*/
+#include "rapic.h"
+
+#include <getopt.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+
+static const char* try_again = "try --help for usage instructions\n";
+static const char* usage_string =
+R"(Rapic archive replay server
+
+usage:
+  rapic_replay [options] input.rapic...
+
+note:
+  This program serves the scans contained in one or more rapic archive files to any
+  clients which connect to it, honouring the RPQUERY and RPFILTER requests of each
+  client.  It is intended as a local stand-in for a real rapic server when testing the
+  throughput and latency of clients.
+
+available options:
+  -h, --help
+      Show this message and exit
+
+  -q, --quiet
+      Suppress output of warnings and statistics
+
+  -a, --address ADDR
+      Address to listen on (default all local interfaces)
+
+  -p, --port SERVICE
+      Port or service to listen on (default 15555)
+
+  -s, --speed FACTOR
+      Replay speed relative to the scan timestamps.  A value of 2 replays twice as fast
+      as real time, while 0 replays as fast as the clients will accept (default 1)
+
+  -l, --loop
+      Replay the input files repeatedly until killed
+
+  -w, --wait N
+      Wait for N clients to connect before starting the replay (default 0)
+
+  -k, --keepalive SECS
+      Send a MSSG keepalive to every client at this interval, 0 to disable (default 30)
+)";
+
+static const char* short_options = "hqa:p:s:lw:k:";
+static struct option long_options[] =
+{
+    { "help",      no_argument, 0, 'h' }
+  , { "quiet",     no_argument, 0, 'q' }
+  , { "address",   required_argument, 0, 'a' }
+  , { "port",      required_argument, 0, 'p' }
+  , { "speed",     required_argument, 0, 's' }
+  , { "loop",      no_argument, 0, 'l' }
+  , { "wait",      required_argument, 0, 'w' }
+  , { "keepalive", required_argument, 0, 'k' }
+  , { 0, 0, 0, 0 }
+};
+
+// stop reading input while more than this many bytes are waiting to be sent
+constexpr size_t max_backlog = 8 * 1024 * 1024;
+
+using clock_type = std::chrono::steady_clock;
+
+bool quiet = false;
+
+auto parse_number(char const* str, double& val) -> bool
+{
+  char* end;
+  val = strtod(str, &end);
+  return end != str && *end == '\0' && val >= 0.0;
+}
+
+auto parse_integer(char const* str, long min, long& val) -> bool
+{
+  char* end;
+  errno = 0;
+  val = strtol(str, &end, 10);
+  return end != str && *end == '\0' && errno == 0 && val >= min;
+}
+
+auto scan_time(rapic::scan const& msg) -> time_t
+{
+  auto h = msg.find_header(rapic::header_id::timestamp);
+  struct tm t;
+  memset(&t, 0, sizeof(t));
+  if (!h || sscanf(h->value().c_str(), "%04d%02d%02d%02d%02d%02d", &t.tm_year, &t.tm_mon, &t.tm_mday, &t.tm_hour, &t.tm_min, &t.tm_sec) != 6)
+    return -1;
+  t.tm_year -= 1900;
+  t.tm_mon -= 1;
+  return timegm(&t);
+}
+
+class replay
+{
+public:
+  replay(double speed, time_t keepalive)
+    : speed_{speed}
+    , keepalive_{keepalive}
+    , last_keepalive_{time(NULL)}
+    , base_time_{-1}
+    , scans_{0}
+    , bytes_{0}
+  { }
+
+  auto listen(std::string const& address, std::string const& service) -> void
+  {
+    srv_.listen(address, service);
+    if (!quiet)
+      std::cout << "listening on port " << srv_.port() << std::endl;
+  }
+
+  auto wait_for_clients(size_t count) -> void
+  {
+    while (srv_.connections() < count)
+      service(100);
+  }
+
+  auto play(char const* path) -> void
+  {
+    rapic::file_reader in{path};
+    uint8_t const* data;
+    size_t size;
+    while (in.next(data, size))
+    {
+      // only the headers are needed to match client filters
+      try
+      {
+        msg_.decode(data, size, rapic::decode_mode::headers_only);
+      }
+      catch (std::exception& err)
+      {
+        if (!quiet)
+          std::cerr << "skipping bad scan in " << path << ": " << err.what() << std::endl;
+        continue;
+      }
+
+      throttle(scan_time(msg_));
+
+      srv_.publish(msg_, std::make_shared<std::vector<uint8_t> const>(data, data + size));
+      ++scans_;
+      bytes_ += size;
+      service(0);
+    }
+  }
+
+  auto drain() -> void
+  {
+    while (srv_.connections() > 0 && srv_.queued() > 0)
+      service(100);
+  }
+
+  auto report(clock_type::duration elapsed) const -> void
+  {
+    auto secs = std::chrono::duration<double>(elapsed).count();
+    std::cout << "sent " << scans_ << " scans (" << bytes_ / (1024.0 * 1024.0) << " MiB) in " << secs << " s, "
+              << scans_ / secs << " scans/s" << std::endl;
+  }
+
+private:
+  // wait until the scan is due for release, and until clients have caught up with the backlog
+  auto throttle(time_t scan_time) -> void
+  {
+    if (speed_ > 0.0 && scan_time != -1)
+    {
+      // restart the clock if the timestamps jump backwards (such as when looping)
+      if (base_time_ == -1 || scan_time < base_time_)
+      {
+        base_time_ = scan_time;
+        base_clock_ = clock_type::now();
+      }
+
+      auto due = base_clock_ + std::chrono::duration_cast<clock_type::duration>(
+            std::chrono::duration<double>((scan_time - base_time_) / speed_));
+      for (auto now = clock_type::now(); now < due; now = clock_type::now())
+      {
+        auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(due - now).count();
+        service(std::max<int>(1, std::min<int>(wait, 100)));
+      }
+    }
+
+    while (srv_.connections() > 0 && srv_.queued() > max_backlog)
+      service(100);
+  }
+
+  auto service(int timeout) -> void
+  {
+    srv_.poll(timeout);
+    while (srv_.process_traffic())
+      ;
+
+    auto now = time(NULL);
+    if (keepalive_ > 0 && now - last_keepalive_ >= keepalive_)
+    {
+      srv_.publish(rapic::mssg{"MSSG: 0 rapic_replay keepalive\n"});
+      last_keepalive_ = now;
+    }
+  }
+
+private:
+  rapic::server           srv_;
+  rapic::scan             msg_;
+  double                  speed_;
+  time_t                  keepalive_;
+  time_t                  last_keepalive_;
+  time_t                  base_time_;     // timestamp of the scan which started the replay clock
+  clock_type::time_point  base_clock_;    // time that the replay clock was started
+  size_t                  scans_;
+  size_t                  bytes_;
+};
+
+int main(int argc, char* argv[])
+{
+  std::string address;
+  std::string service = "15555";
+  double speed = 1.0;
+  bool loop = false;
+  long wait = 0;
+  long keepalive = 30;
+
+  // process options
+  while (true)
+  {
+    int option_index = 0;
+    int c = getopt_long(argc, argv, short_options, long_options, &option_index);
+    if (c == -1)
+      break;
+    switch (c)
+    {
+    case 'h':
+      std::cout << usage_string;
+      return EXIT_SUCCESS;
+    case 'q':
+      quiet = true;
+      break;
+    case 'a':
+      address = optarg;
+      break;
+    case 'p':
+      service = optarg;
+      break;
+    case 's':
+      if (!parse_number(optarg, speed))
+      {
+        std::cerr << "invalid replay speed\n" << try_again;
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'l':
+      loop = true;
+      break;
+    case 'w':
+      if (!parse_integer(optarg, 0, wait))
+      {
+        std::cerr << "invalid client count\n" << try_again;
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'k':
+      if (!parse_integer(optarg, 0, keepalive))
+      {
+        std::cerr << "invalid keepalive interval\n" << try_again;
+        return EXIT_FAILURE;
+      }
+      break;
+    case '?':
+      std::cerr << try_again;
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (argc - optind < 1)
+  {
+    std::cerr << "missing required parameters\n" << try_again;
+    return EXIT_FAILURE;
+  }
+
+  try
+  {
+    replay rep{speed, static_cast<time_t>(keepalive)};
+    rep.listen(address, service);
+    rep.wait_for_clients(wait);
+
+    auto start = clock_type::now();
+    do
+    {
+      for (int i = optind; i < argc; ++i)
+        rep.play(argv[i]);
+    } while (loop);
+    rep.drain();
+
+    if (!quiet)
+      rep.report(clock_type::now() - start);
+  }
+  catch (std::exception& err)
+  {
+    std::cerr << "fatal error: " << err.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}